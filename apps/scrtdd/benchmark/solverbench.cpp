@@ -0,0 +1,407 @@
+/***************************************************************************
+ *   Copyright (C) by ETHZ/SED                                             *
+ *                                                                         *
+ * This program is free software: you can redistribute it and/or modify    *
+ * it under the terms of the GNU Affero General Public License as published*
+ * by the Free Software Foundation, either version 3 of the License, or    *
+ * (at your option) any later version.                                     *
+ *                                                                         *
+ * This program is distributed in the hope that it will be useful,         *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of          *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           *
+ * GNU Affero General Public License for more details.                     *
+ *                                                                         *
+ *                                                                         *
+ *   Developed by Luca Scarabello <luca.scarabello@sed.ethz.ch>            *
+ ***************************************************************************/ 
+
+/*
+ * Solver scaling benchmark: relocate a synthetic catalog of event clusters
+ * with LSMR and LSQR and report the time spent in each phase of
+ * Solver::solve, the solver iterations and the peak memory usage.
+ *
+ * The true events are randomly placed in clusters, the starting locations
+ * are perturbed and the observed double-differences are computed from the
+ * true locations with a homogeneous velocity model. Each event is paired
+ * with random neighbours of its own cluster and each pair is observed by
+ * every station with both P and S phases.
+ */
+
+#include "solver.h"
+#include "utils.h"
+
+#include <seiscomp3/math/geo.h>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <sys/resource.h>
+
+using namespace std;
+using namespace Seiscomp::HDD;
+
+namespace {
+
+struct Options {
+    unsigned events = 1000;
+    unsigned clusters = 10;
+    unsigned stations = 20;
+    unsigned neighbours = 10;
+    unsigned solves = 3;         // algorithm iterations (incremental solves)
+    unsigned iterations = 0;     // solver iterations, 0 = automatic
+    unsigned threads = 1;
+    bool blockJacobi = false;
+    bool checkBlockJacobi = false;
+    unsigned seed = 1;
+    vector<string> types = {"LSMR", "LSQR"};
+};
+
+struct Location {
+    double lat, lon, depth;
+};
+
+const double VelocityP = 6.0; // km/s
+const double VelocityS = 3.5; // km/s
+
+void usage(const char *prog)
+{
+    fprintf(stderr,
+        "Usage: %s [options]\n"
+        "  --events N        number of events (default 1000)\n"
+        "  --clusters N      number of event clusters (default 10)\n"
+        "  --stations N      number of stations (default 20)\n"
+        "  --neighbours N    neighbours of each event (default 10)\n"
+        "  --solves N        consecutive solves of the same system (default 3)\n"
+        "  --iterations N    solver iterations, 0 = automatic (default 0)\n"
+        "  --threads N       solver threads, 0 = all cores (default 1)\n"
+        "  --block-jacobi    enable block-Jacobi preconditioning\n"
+        "  --check-block-jacobi  check that block-Jacobi preconditioning doesn't\n"
+        "                    change the solution nor slow down the convergence,\n"
+        "                    exit with 1 if it does\n"
+        "  --solver TYPE     LSMR or LSQR (default both)\n"
+        "  --seed N          random seed (default 1)\n"
+        "The number of observations is events*neighbours*stations*2\n", prog);
+}
+
+Options parseOptions(int argc, char **argv)
+{
+    Options opt;
+    for ( int i = 1; i < argc; i++ )
+    {
+        const string arg = argv[i];
+        auto value = [&]() -> unsigned {
+            if ( i + 1 >= argc )
+                throw runtime_error("Missing value for " + arg);
+            return std::stoul(argv[++i]);
+        };
+
+        if ( arg == "--help" || arg == "-h" )
+        {
+            usage(argv[0]);
+            exit(0);
+        }
+        else if ( arg == "--events" )     opt.events = value();
+        else if ( arg == "--clusters" )   opt.clusters = value();
+        else if ( arg == "--stations" )   opt.stations = value();
+        else if ( arg == "--neighbours" ) opt.neighbours = value();
+        else if ( arg == "--solves" )     opt.solves = value();
+        else if ( arg == "--iterations" ) opt.iterations = value();
+        else if ( arg == "--threads" )    opt.threads = value();
+        else if ( arg == "--seed" )       opt.seed = value();
+        else if ( arg == "--block-jacobi" ) opt.blockJacobi = true;
+        else if ( arg == "--check-block-jacobi" ) opt.checkBlockJacobi = true;
+        else if ( arg == "--solver" && i + 1 < argc ) opt.types = { argv[++i] };
+        else
+            throw runtime_error("Unknown option " + arg);
+    }
+    if ( opt.events < 2 || opt.clusters < 1 || opt.clusters > opt.events / 2 ||
+         opt.stations < 1 || opt.neighbours < 1 || opt.solves < 1 )
+        throw runtime_error("Invalid options");
+    return opt;
+}
+
+double travelTime(const Location& ev, const Location& sta, char phase)
+{
+    double distance = computeDistance(ev.lat, ev.lon, ev.depth, sta.lat, sta.lon, sta.depth);
+    return distance / (phase == 'P' ? VelocityP : VelocityS);
+}
+
+double secondsSince(const chrono::steady_clock::time_point& start)
+{
+    return chrono::duration<double>(chrono::steady_clock::now() - start).count();
+}
+
+// peak resident memory in MB
+double peakMemory()
+{
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss / 1024.; // kB on Linux
+}
+
+struct Synthetic {
+    vector<Location> trueEvents, events;
+    vector<unsigned> clusterByEv;
+    vector<vector<unsigned>> clusterEvents;
+    vector<Location> stations;
+    vector<string> stationIds;
+    vector<vector<unsigned>> neighbours;
+};
+
+Synthetic generate(const Options& opt)
+{
+    Synthetic syn;
+    vector<Location>& trueEvents = syn.trueEvents;
+    vector<Location>& events = syn.events;
+    vector<unsigned>& clusterByEv = syn.clusterByEv;
+    vector<vector<unsigned>>& clusterEvents = syn.clusterEvents;
+    vector<Location>& stations = syn.stations;
+    vector<string>& stationIds = syn.stationIds;
+    vector<vector<unsigned>>& neighbours = syn.neighbours;
+
+    mt19937 gen(opt.seed);
+    uniform_real_distribution<double> uniform(-1, 1);
+
+    //
+    // Synthetic catalog and stations
+    //
+    trueEvents.resize(opt.events);
+    events.resize(opt.events);
+    clusterByEv.resize(opt.events);
+    clusterEvents.resize(opt.clusters);
+    vector<Location> clusterCenters(opt.clusters);
+    for ( Location& center : clusterCenters )
+        center = { 46 + 0.5 * uniform(gen), 8 + 0.5 * uniform(gen), 7 + 4 * uniform(gen) };
+
+    for ( unsigned ev = 0; ev < opt.events; ev++ )
+    {
+        const unsigned c = ev % opt.clusters;
+        const Location& center = clusterCenters[c];
+        clusterByEv[ev] = c;
+        clusterEvents[c].push_back(ev);
+        trueEvents[ev] = { center.lat + 0.02 * uniform(gen),
+                           center.lon + 0.02 * uniform(gen),
+                           center.depth + 1.0 * uniform(gen) };
+        // starting locations are off by ~1 km
+        events[ev] = { trueEvents[ev].lat + 0.01 * uniform(gen),
+                       trueEvents[ev].lon + 0.01 * uniform(gen),
+                       trueEvents[ev].depth + 1.0 * uniform(gen) };
+    }
+
+    stations.resize(opt.stations);
+    stationIds.resize(opt.stations);
+    for ( unsigned s = 0; s < opt.stations; s++ )
+    {
+        stations[s] = { 46 + 1.5 * uniform(gen), 8 + 1.5 * uniform(gen), -0.5 * (uniform(gen) + 1) };
+        stationIds[s] = "XX.S" + to_string(s) + ".";
+    }
+
+    neighbours.resize(opt.events);
+    for ( unsigned ev = 0; ev < opt.events; ev++ )
+    {
+        const vector<unsigned>& candidates = clusterEvents[clusterByEv[ev]];
+        uniform_int_distribution<unsigned> pick(0, candidates.size() - 1);
+        while ( neighbours[ev].size() < std::min<size_t>(opt.neighbours, candidates.size() - 1) )
+        {
+            unsigned other = candidates[pick(gen)];
+            if ( other != ev &&
+                 std::find(neighbours[ev].begin(), neighbours[ev].end(), other) == neighbours[ev].end() )
+                neighbours[ev].push_back(other);
+        }
+    }
+
+    return syn;
+}
+
+
+void addObservations(const Synthetic& syn, Solver& solver, bool addDiffTimes)
+{
+    for ( unsigned ev1 = 0; addDiffTimes && ev1 < syn.events.size(); ev1++ )
+    {
+        for ( unsigned ev2 : syn.neighbours[ev1] )
+        {
+            for ( unsigned s = 0; s < syn.stations.size(); s++ )
+            {
+                for ( char phase : {'P', 'S'} )
+                {
+                    double diffTime = travelTime(syn.trueEvents[ev1], syn.stations[s], phase) -
+                                      travelTime(syn.trueEvents[ev2], syn.stations[s], phase);
+                    solver.addObservation(ev1, ev2, syn.stationIds[s], phase, diffTime, 1.0,
+                                          true, true, false);
+                }
+            }
+        }
+    }
+    for ( unsigned ev = 0; ev < syn.events.size(); ev++ )
+    {
+        for ( unsigned s = 0; s < syn.stations.size(); s++ )
+        {
+            for ( char phase : {'P', 'S'} )
+            {
+                const Location& sta = syn.stations[s];
+                solver.addObservationParams(ev, syn.stationIds[s], phase,
+                        syn.events[ev].lat, syn.events[ev].lon, syn.events[ev].depth,
+                        sta.lat, sta.lon, -sta.depth * 1000,
+                        travelTime(syn.events[ev], sta, phase));
+            }
+        }
+    }
+}
+
+
+void run(const Options& opt, const string& type)
+{
+    Synthetic syn = generate(opt);
+    const vector<Location>& trueEvents = syn.trueEvents;
+    vector<Location>& events = syn.events;
+    const vector<unsigned>& clusterByEv = syn.clusterByEv;
+    const vector<vector<unsigned>>& clusterEvents = syn.clusterEvents;
+
+    printf("%s: %u events, %u clusters, %u stations, %u neighbours, %u threads\n",
+           type.c_str(), opt.events, opt.clusters, opt.stations, opt.neighbours, opt.threads);
+    printf("%5s %10s %8s %6s %9s %9s %9s %9s %9s %9s %9s %9s\n", "solve", "obs", "events",
+           "iter", "setup[s]", "prep[s]", "norm[s]", "iter[s]", "load[s]", "total[s]",
+           "err[km]", "mem[MB]");
+
+    Solver solver(type, opt.threads);
+
+    for ( unsigned solve = 0; solve < opt.solves; solve++ )
+    {
+        //
+        // The observations are added only the first time, after that the
+        // system is incrementally updated with the new event locations
+        //
+        auto start = chrono::steady_clock::now();
+        addObservations(syn, solver, solve == 0);
+        const double setupTime = secondsSince(start);
+
+        start = chrono::steady_clock::now();
+        solver.solve(opt.iterations, 0.01, 0, 0, 0, 0, 0, true, opt.blockJacobi);
+        const double solveTime = secondsSince(start);
+
+        vector<Location> clusterShift(opt.clusters, {0, 0, 0});
+        for ( unsigned ev = 0; ev < opt.events; ev++ )
+        {
+            double deltaLat, deltaLon, deltaDepth, deltaTT;
+            if ( solver.getEventChanges(ev, deltaLat, deltaLon, deltaDepth, deltaTT) )
+            {
+                events[ev].lat += deltaLat;
+                events[ev].lon += deltaLon;
+                events[ev].depth += deltaDepth;
+                solver.shiftEventOriginTime(ev, deltaTT);
+            }
+            Location& shift = clusterShift[clusterByEv[ev]];
+            shift.lat += (events[ev].lat - trueEvents[ev].lat) / clusterEvents[clusterByEv[ev]].size();
+            shift.lon += (events[ev].lon - trueEvents[ev].lon) / clusterEvents[clusterByEv[ev]].size();
+            shift.depth += (events[ev].depth - trueEvents[ev].depth) / clusterEvents[clusterByEv[ev]].size();
+        }
+
+        // the double-difference doesn't resolve the absolute location of the
+        // clusters, so the error is computed on the relative locations
+        double sumSquaredErrors = 0;
+        for ( unsigned ev = 0; ev < opt.events; ev++ )
+        {
+            const Location& shift = clusterShift[clusterByEv[ev]];
+            sumSquaredErrors += std::pow(computeDistance(events[ev].lat - shift.lat,
+                                                         events[ev].lon - shift.lon,
+                                                         events[ev].depth - shift.depth,
+                                                         trueEvents[ev].lat, trueEvents[ev].lon,
+                                                         trueEvents[ev].depth), 2);
+        }
+
+        const Solver::SolveStats& stats = solver.getSolveStats();
+        printf("%5u %10u %8u %6u %9.3f %9.3f %9.3f %9.3f %9.3f %9.3f %9.4f %9.1f\n",
+               solve, stats.numObservations, stats.numEvents, stats.iterations,
+               setupTime, stats.prepareTime, stats.normalizeTime, stats.solverTime,
+               stats.loadTime, solveTime, std::sqrt(sumSquaredErrors / opt.events),
+               peakMemory());
+    }
+}
+
+
+/*
+ * Solve the same system with and without block-Jacobi preconditioning and
+ * compare the event changes. No damping is applied (the damping acts on the
+ * preconditioned parameters and would make the solutions differ) and the mean
+ * shift constraints pin down the cluster locations, which the
+ * double-differences alone don't resolve, so the least squares solution is
+ * unique and both runs must converge to it. The preconditioning is also
+ * expected not to slow down the convergence.
+ */
+bool checkBlockJacobi(const Options& opt, const string& type)
+{
+    Synthetic syn = generate(opt);
+
+    vector<vector<Location>> changes(2, vector<Location>(opt.events));
+    vector<vector<double>> ttChanges(2, vector<double>(opt.events));
+    vector<unsigned> iterations(2);
+    for ( unsigned precond = 0; precond < 2; precond++ )
+    {
+        Solver solver(type, opt.threads);
+        addObservations(syn, solver, true);
+        solver.solve(opt.iterations, 0, 0, 1, 1, 1, 1, true, precond == 1);
+        iterations[precond] = solver.getSolveStats().iterations;
+        for ( unsigned ev = 0; ev < opt.events; ev++ )
+        {
+            Location& change = changes[precond][ev];
+            change = {0, 0, 0};
+            ttChanges[precond][ev] = 0;
+            solver.getEventChanges(ev, change.lat, change.lon, change.depth, ttChanges[precond][ev]);
+        }
+    }
+
+    // differences in km and in km at P velocity for the origin times
+    double maxChange = 0, maxDiff = 0;
+    for ( unsigned ev = 0; ev < opt.events; ev++ )
+    {
+        const Location& ev0 = syn.events[ev];
+        const Location& ch0 = changes[0][ev];
+        const Location& ch1 = changes[1][ev];
+        maxChange = std::max(maxChange, computeDistance(ev0.lat, ev0.lon, ev0.depth,
+                                                        ev0.lat + ch0.lat, ev0.lon + ch0.lon,
+                                                        ev0.depth + ch0.depth));
+        maxDiff = std::max(maxDiff, computeDistance(ev0.lat + ch0.lat, ev0.lon + ch0.lon,
+                                                    ev0.depth + ch0.depth,
+                                                    ev0.lat + ch1.lat, ev0.lon + ch1.lon,
+                                                    ev0.depth + ch1.depth));
+        maxDiff = std::max(maxDiff, std::abs(ttChanges[0][ev] - ttChanges[1][ev]) * VelocityP);
+    }
+
+    const double tolerance = 0.001; // km
+    const bool ok = maxDiff <= tolerance && iterations[1] <= iterations[0];
+    printf("%s: iterations %u (block-Jacobi %u), max change %.4f km, "
+           "max difference %.6f km: %s\n", type.c_str(), iterations[0], iterations[1],
+           maxChange, maxDiff, ok ? "OK" : "FAILED");
+    return ok;
+}
+
+}
+
+
+int main(int argc, char **argv)
+{
+    try {
+        Options opt = parseOptions(argc, argv);
+        bool ok = true;
+        for ( const string& type : opt.types )
+        {
+            if ( opt.checkBlockJacobi )
+                ok = checkBlockJacobi(opt, type) && ok;
+            else
+                run(opt, type);
+        }
+        if ( ! ok )
+            return 1;
+    } catch ( exception& e ) {
+        fprintf(stderr, "%s\n", e.what());
+        usage(argv[0]);
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,154 @@
+/***************************************************************************
+ *   Copyright (C) by ETHZ/SED                                             *
+ *                                                                         *
+ * This program is free software: you can redistribute it and/or modify    *
+ * it under the terms of the GNU Affero General Public License as published*
+ * by the Free Software Foundation, either version 3 of the License, or    *
+ * (at your option) any later version.                                     *
+ *                                                                         *
+ * This program is distributed in the hope that it will be useful,         *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of          *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           *
+ * GNU Affero General Public License for more details.                     *
+ *                                                                         *
+ *                                                                         *
+ *   Developed by Luca Scarabello <luca.scarabello@sed.ethz.ch>            *
+ ***************************************************************************/ 
+
+
+#ifndef __RTDD_APPLICATIONS_BLAS1_H__
+#define __RTDD_APPLICATIONS_BLAS1_H__
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+#ifdef RTDD_USE_CBLAS
+#include <cblas.h>
+#endif
+
+/*
+ * BLAS level 1 primitives used by the least-squares solvers (lsmr, lsqr).
+ * When RTDD_USE_CBLAS is defined the system CBLAS library is used, otherwise
+ * the loops below are written with independent accumulators so that the
+ * compiler can vectorize them without relaxing the floating point semantics
+ */
+namespace Seiscomp {
+namespace HDD {
+namespace Blas1 {
+
+/*
+ * y = y + alpha * x
+ */
+inline void axpy(unsigned n, double alpha, const double *x, double *y)
+{
+#ifdef RTDD_USE_CBLAS
+    cblas_daxpy(n, alpha, x, 1, y, 1);
+#else
+    for ( unsigned i = 0; i < n; i++ )
+        y[i] += alpha * x[i];
+#endif
+}
+
+/*
+ * x = alpha * x
+ */
+inline void scal(unsigned n, double alpha, double *x)
+{
+#ifdef RTDD_USE_CBLAS
+    cblas_dscal(n, alpha, x, 1);
+#else
+    for ( unsigned i = 0; i < n; i++ )
+        x[i] *= alpha;
+#endif
+}
+
+/*
+ * x' * y
+ */
+inline double dot(unsigned n, const double *x, const double *y)
+{
+#ifdef RTDD_USE_CBLAS
+    return cblas_ddot(n, x, 1, y, 1);
+#else
+    double sum[4] = {0};
+    unsigned i = 0;
+    for ( ; i + 4 <= n; i += 4 )
+    {
+        sum[0] += x[i+0] * y[i+0];
+        sum[1] += x[i+1] * y[i+1];
+        sum[2] += x[i+2] * y[i+2];
+        sum[3] += x[i+3] * y[i+3];
+    }
+    for ( ; i < n; i++ )
+        sum[0] += x[i] * y[i];
+    return (sum[0] + sum[1]) + (sum[2] + sum[3]);
+#endif
+}
+
+/*
+ * Euclidean norm of x, without overflow or underflow. The plain sum of
+ * squares is computed first and, only when it is not representable, the
+ * vector is scaled by its largest element
+ */
+inline double nrm2(unsigned n, const double *x)
+{
+#ifdef RTDD_USE_CBLAS
+    return cblas_dnrm2(n, x, 1);
+#else
+    // below this the sum of squares might have lost precision to underflow
+    static const double minSumOfSquares = std::numeric_limits<double>::min() /
+                                          std::numeric_limits<double>::epsilon();
+
+    const double sumOfSquares = dot(n, x, x);
+    if ( sumOfSquares >= minSumOfSquares &&
+         sumOfSquares <= std::numeric_limits<double>::max() )
+    {
+        return std::sqrt(sumOfSquares);
+    }
+    if ( std::isnan(sumOfSquares) )
+        return sumOfSquares;
+
+    double maxAbs[4] = {0};
+    unsigned i = 0;
+    for ( ; i + 4 <= n; i += 4 )
+    {
+        maxAbs[0] = std::max(maxAbs[0], std::abs(x[i+0]));
+        maxAbs[1] = std::max(maxAbs[1], std::abs(x[i+1]));
+        maxAbs[2] = std::max(maxAbs[2], std::abs(x[i+2]));
+        maxAbs[3] = std::max(maxAbs[3], std::abs(x[i+3]));
+    }
+    for ( ; i < n; i++ )
+        maxAbs[0] = std::max(maxAbs[0], std::abs(x[i]));
+    const double largest = std::max(std::max(maxAbs[0], maxAbs[1]),
+                                    std::max(maxAbs[2], maxAbs[3]));
+
+    if ( largest == 0 || std::isinf(largest) )
+        return largest;
+
+    // divide rather than multiply by the reciprocal, which could overflow
+    // for subnormal values of largest
+    double sum[4] = {0};
+    for ( i = 0; i + 4 <= n; i += 4 )
+    {
+        const double s0 = x[i+0] / largest, s1 = x[i+1] / largest,
+                     s2 = x[i+2] / largest, s3 = x[i+3] / largest;
+        sum[0] += s0 * s0;
+        sum[1] += s1 * s1;
+        sum[2] += s2 * s2;
+        sum[3] += s3 * s3;
+    }
+    for ( ; i < n; i++ )
+    {
+        const double s = x[i] / largest;
+        sum[0] += s * s;
+    }
+    return largest * std::sqrt((sum[0] + sum[1]) + (sum[2] + sum[3]));
+#endif
+}
+
+}
+}
+}
+
+#endif
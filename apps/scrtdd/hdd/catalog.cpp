@@ -36,6 +36,7 @@
 #include <cmath>
 #include <boost/filesystem.hpp>
 #include <boost/bind.hpp>
+#include <boost/functional/hash.hpp>
 #include <boost/range/iterator_range_core.hpp>
 
 #define SEISCOMP_COMPONENT RTDD
@@ -47,36 +48,17 @@ using Seiscomp::Core::stringify;
 
 namespace {
 
-template <class Map, class Val> typename Map::iterator
-searchByValue(Map & SearchMap, const Val & SearchVal)
+size_t eventValueHash(const HDD::Catalog::Event& event)
 {
-    typename Map::iterator iRet = SearchMap.end();
-    for (typename Map::iterator iTer = SearchMap.begin(); iTer != SearchMap.end(); iTer ++)
-    {
-        if (iTer->second == SearchVal)
-        {
-            iRet = iTer;
-            break;
-        }
-    }
-    return iRet;
-}
-
-
-
-template <class Map, class Val> typename Map::const_iterator
-searchByValue(const Map & SearchMap, const Val & SearchVal)
-{
-    typename Map::const_iterator iRet = SearchMap.end();
-    for (typename Map::const_iterator iTer = SearchMap.begin(); iTer != SearchMap.end(); iTer ++)
-    {
-        if (iTer->second == SearchVal)
-        {
-            iRet = iTer;
-            break;
-        }
-    }
-    return iRet;
+    // hash the same values compared by Catalog::Event::operator==
+    size_t seed = 0;
+    boost::hash_combine(seed, double(event.time.seconds()));
+    boost::hash_combine(seed, event.latitude);
+    boost::hash_combine(seed, event.longitude);
+    boost::hash_combine(seed, event.depth);
+    boost::hash_combine(seed, event.magnitude);
+    boost::hash_combine(seed, event.rms);
+    return seed;
 }
 
 
@@ -198,35 +180,43 @@ Catalog::Catalog() : Catalog(unordered_map<string,Station>(),
 Catalog::Catalog(const unordered_map<string,Station>& stations,
                  const map<unsigned,Event>& events,
                  const unordered_multimap<unsigned,Phase>& phases)
-        : _stations(stations),
-          _events(events),
-          _phases(phases) 
 {
+    *_stations = stations;
+    _events->events = events;
+    _phases->phases = phases;
+    _events->buildIndex();
+    _phases->buildIndex();
 }
 
 
 Catalog::Catalog(unordered_map<string,Station>&& stations,
                  map<unsigned,Event>&& events,
                  unordered_multimap<unsigned,Phase>&& phases)
-        : _stations(stations),
-          _events(events),
-          _phases(phases) 
 {
+    *_stations = std::move(stations);
+    _events->events = std::move(events);
+    _phases->phases = std::move(phases);
+    _events->buildIndex();
+    _phases->buildIndex();
 }
 
 
 
-Catalog::Catalog(const Catalog& other) : Catalog(other._stations,
-                                                 other._events,
-                                                 other._phases)
+Catalog::Catalog(const Catalog& other) : _stations(other._stations),
+                                         _events(other._events),
+                                         _phases(other._phases)
 { }
 
 
 
-Catalog::Catalog(Catalog&& other) : Catalog(std::move(other._stations),
-                                            std::move(other._events),
-                                            std::move(other._phases) )
-{ }
+Catalog::Catalog(Catalog&& other) : _stations(other._stations),
+                                    _events(other._events),
+                                    _phases(other._phases)
+{
+    other._stations = std::make_shared<StationData>();
+    other._events   = std::make_shared<EventData>();
+    other._phases   = std::make_shared<PhaseData>();
+}
 
 
 Catalog& Catalog::operator=(const Catalog& other)
@@ -243,9 +233,12 @@ Catalog& Catalog::operator=(const Catalog& other)
 Catalog& Catalog::operator=(Catalog&& other)
 {
     if (this == &other) return *this;
-    _stations = std::move(other._stations);
-    _events   = std::move(other._events);
-    _phases   = std::move(other._phases);
+    _stations = other._stations;
+    _events   = other._events;
+    _phases   = other._phases;
+    other._stations = std::make_shared<StationData>();
+    other._events   = std::make_shared<EventData>();
+    other._phases   = std::make_shared<PhaseData>();
     return *this;
 }
 
@@ -286,7 +279,7 @@ Catalog::Catalog(const string& stationFile,
         sta.networkCode = row.at("networkCode");
         sta.stationCode = row.at("stationCode");
         sta.locationCode = row.at("locationCode");
-        _stations[sta.id] = sta;
+        (*_stations)[sta.id] = sta;
     }
 
     vector<unordered_map<string,string> >events = CSV::readWithHeader(eventFile);
@@ -315,7 +308,7 @@ Catalog::Catalog(const string& stationFile,
             ev.relocInfo.meanObsWeight      = std::stod(row.at("meanObsWeight"));
             ev.relocInfo.meanFinalObsWeight = std::stod(row.at("meanFinalObsWeight")); 
         }
-        _events[ev.id] = ev;
+        _events->events[ev.id] = ev;
     }
 
     vector<unordered_map<string,string> >phases = CSV::readWithHeader(phaFile);
@@ -346,8 +339,11 @@ Catalog::Catalog(const string& stationFile,
             ph.relocInfo.meanObsWeight      = std::stod(row.at("meanObsWeight"));
             ph.relocInfo.meanFinalObsWeight = std::stod(row.at("meanFinalObsWeight"));
         }
-        _phases.emplace(ph.eventId, ph);
+        _phases->phases.emplace(ph.eventId, ph);
     }
+
+    _events->buildIndex();
+    _phases->buildIndex();
 }
 
 
@@ -432,7 +428,7 @@ void Catalog::add(const std::vector<DataModel::OriginPtr>& origins,
             } catch ( Core::ValueException& ) { }
 
             // add station if not already there
-            if ( searchStation(sta.networkCode, sta.stationCode, sta.locationCode) == _stations.end() )
+            if ( searchStation(sta.networkCode, sta.stationCode, sta.locationCode) == _stations->end() )
             {
                 DataModel::SensorLocation *loc = findSensorLocation(sta.networkCode, sta.stationCode,
                                                                     sta.locationCode, pick->time());
@@ -523,7 +519,7 @@ void Catalog::add(const Catalog& other, bool keepEvId)
     for (const auto& kv :  other.getEvents() )
     {
         const Catalog::Event& event = kv.second;
-        if ( keepEvId && _events.find(event.id) != _events.end() )
+        if ( keepEvId && getEvents().find(event.id) != getEvents().end() )
         {
             SEISCOMP_DEBUG("Skipping duplicated event id %u", event.id);
             continue;
@@ -550,7 +546,8 @@ CatalogPtr Catalog::extractEvent(unsigned eventId, bool keepEvId) const
 
     if ( keepEvId )
     {
-        eventToExtract->_events[event.id] = event;
+        eventToExtract->events().events[event.id] = event;
+        eventToExtract->events().addToIndex(event);
         newEventId = event.id;
     }
     else
@@ -563,7 +560,7 @@ CatalogPtr Catalog::extractEvent(unsigned eventId, bool keepEvId) const
     {
         Catalog::Phase phase = it->second;
 
-        const Catalog::Station& station = _stations.at(phase.stationId);
+        const Catalog::Station& station = getStations().at(phase.stationId);
         eventToExtract->addStation(station);
 
         phase.eventId = newEventId;
@@ -579,13 +576,14 @@ unsigned Catalog::add(unsigned evId, const Catalog& evCat, bool keepEvId)
 {
     unsigned newEventId;
 
-    const Catalog::Event& event = evCat._events.find(evId)->second;
+    const Catalog::Event& event = evCat.getEvents().find(evId)->second;
 
     if ( keepEvId )
     {
-        if  (_events.find(event.id) != _events.end() )
+        if  (getEvents().find(event.id) != getEvents().end() )
             throw runtime_error("Cannot add event, internal logic error");
-        _events[event.id] = event;
+        events().events[event.id] = event;
+        events().addToIndex(event);
         newEventId = event.id;
     }
     else
@@ -594,12 +592,12 @@ unsigned Catalog::add(unsigned evId, const Catalog& evCat, bool keepEvId)
         newEventId = addEvent(event);
     }
 
-    auto eqlrng = evCat._phases.equal_range(event.id);
+    auto eqlrng = evCat.getPhases().equal_range(event.id);
     for (auto it = eqlrng.first; it != eqlrng.second; ++it)
     {
         Catalog::Phase phase = it->second;
 
-        const Catalog::Station& station = evCat._stations.at(phase.stationId); 
+        const Catalog::Station& station = evCat.getStations().at(phase.stationId); 
         addStation(station);
 
         phase.eventId = newEventId;
@@ -612,32 +610,36 @@ unsigned Catalog::add(unsigned evId, const Catalog& evCat, bool keepEvId)
 
 void Catalog::removeEvent(unsigned eventId)
 {
-    map<unsigned,Catalog::Event>::const_iterator it = _events.find(eventId);
-    if ( it != _events.end() )
+    if ( getEvents().find(eventId) != getEvents().end() )
     {
-        _events.erase(it);
+        EventData& evData = events();
+        map<unsigned,Catalog::Event>::const_iterator it = evData.events.find(eventId);
+        evData.removeFromIndex(it->second);
+        evData.events.erase(it);
     }
-    auto eqlrng = _phases.equal_range(eventId);
-    _phases.erase(eqlrng.first, eqlrng.second);
+
+    if ( getPhases().find(eventId) != getPhases().end() )
+        phases().removeEvent(eventId);
 }
 
 
 void Catalog::removePhase(unsigned eventId, const std::string& stationId, const Phase::Type& type)
 {
-    unordered_map<unsigned,Phase>::const_iterator it = searchPhase(eventId, stationId, type);
-    if ( it != _phases.end() )
-    {
-        _phases.erase(it);
-    }
+    if ( searchPhase(eventId, stationId, type) == getPhases().end() )
+        return;
+
+    PhaseData& phData = phases();
+    PhaseIterator it = phData.find(eventId, stationId, type);
+    phData.removeFromIndex(it);
+    phData.phases.erase(it);
 }
 
 
 bool Catalog::updateStation(const Station& newStation, bool addIfMissing)
 {
-    unordered_map<string,Catalog::Station>::iterator it = _stations.find(newStation.id);
-    if ( it != _stations.end() )
+    if ( getStations().find(newStation.id) != getStations().end() )
     {
-        it->second = newStation;
+        stations().at(newStation.id) = newStation;
         return true;
     }
     else if ( addIfMissing )
@@ -650,10 +652,13 @@ bool Catalog::updateStation(const Station& newStation, bool addIfMissing)
 
 bool Catalog::updateEvent(const Event& newEv, bool addIfMissing)
 {
-    map<unsigned,Catalog::Event>::iterator it = _events.find(newEv.id);
-    if ( it != _events.end() )
+    if ( getEvents().find(newEv.id) != getEvents().end() )
     {
-        it->second = newEv;
+        EventData& evData = events();
+        Event& event = evData.events.at(newEv.id);
+        evData.removeFromIndex(event);
+        event = newEv;
+        evData.addToIndex(event);
         return true;
     }
     else if ( addIfMissing )
@@ -666,16 +671,10 @@ bool Catalog::updateEvent(const Event& newEv, bool addIfMissing)
 
 bool Catalog::updatePhase(const Phase& newPh, bool addIfMissing)
 {
-    auto eqlrng = _phases.equal_range(newPh.eventId);
-    for (auto it = eqlrng.first; it != eqlrng.second; ++it)
+    if ( searchPhase(newPh.eventId, newPh.stationId, newPh.procInfo.type) != getPhases().end() )
     {
-        Catalog::Phase& ph = it->second;
-        if ( ph.stationId     == newPh.stationId &&
-             ph.procInfo.type == newPh.procInfo.type )
-        {
-            ph = newPh;
-            return true;
-        }
+        phases().find(newPh.eventId, newPh.stationId, newPh.procInfo.type)->second = newPh;
+        return true;
     }
 
     if ( addIfMissing )
@@ -686,10 +685,41 @@ bool Catalog::updatePhase(const Phase& newPh, bool addIfMissing)
 }
 
 
+void Catalog::replacePhases(unsigned eventId, const std::vector<Phase>& newPhases)
+{
+    PhaseData& phData = phases();
+    phData.removeEvent(eventId);
+    for (const Phase& ph : newPhases)
+        phData.add(ph);
+}
+
+
 map<unsigned,Catalog::Event>::const_iterator
 Catalog::searchEvent(const Event& event) const
 {
-    return searchByValue(_events, event);
+    // if several events have the same values, return the one with lowest id
+    auto found = getEvents().end();
+    auto eqlrng = _events->byValue.equal_range( eventValueHash(event) );
+    for (auto it = eqlrng.first; it != eqlrng.second; ++it)
+    {
+        if ( found != getEvents().end() && found->first < it->second )
+            continue;
+        auto ev = getEvents().find(it->second);
+        if ( ev->second == event )
+            found = ev;
+    }
+    return found;
+}
+
+
+unordered_map<std::string,Catalog::Station>::const_iterator
+Catalog::searchStation(const Station& station) const
+{
+    // the station id is built from the codes, so a matching station must have it
+    auto it = searchStation(station.networkCode, station.stationCode, station.locationCode);
+    if ( it != getStations().end() && it->second == station )
+        return it;
+    return getStations().end();
 }
 
 
@@ -699,32 +729,157 @@ Catalog::searchStation(const std::string& networkCode,
                        const std::string& locationCode) const
 {
     string stationId = networkCode + "." + stationCode + "." + locationCode;
-    return _stations.find(stationId);
+    return getStations().find(stationId);
 }
 
 
 unordered_map<unsigned,Catalog::Phase>::const_iterator
 Catalog::searchPhase(unsigned eventId, const std::string& stationId, const Phase::Type& type) const
 {
-    auto eqlrng = _phases.equal_range(eventId);
+    return _phases->find(eventId, stationId, type);
+}
+
+
+Catalog::StationData& Catalog::stations()
+{
+    if ( _stations.use_count() > 1 )
+        _stations = std::make_shared<StationData>(*_stations);
+    return *_stations;
+}
+
+
+Catalog::EventData& Catalog::events()
+{
+    if ( _events.use_count() > 1 )
+        _events = std::make_shared<EventData>(*_events);
+    return *_events;
+}
+
+
+Catalog::PhaseData& Catalog::phases()
+{
+    if ( _phases.use_count() > 1 )
+        _phases = std::make_shared<PhaseData>(*_phases);
+    return *_phases;
+}
+
+
+void Catalog::EventData::buildIndex()
+{
+    byValue.clear();
+    byValue.reserve(events.size());
+    for (const auto& kv : events)
+        addToIndex(kv.second);
+}
+
+
+void Catalog::EventData::addToIndex(const Event& event)
+{
+    byValue.emplace(eventValueHash(event), event.id);
+}
+
+
+void Catalog::EventData::removeFromIndex(const Event& event)
+{
+    auto eqlrng = byValue.equal_range( eventValueHash(event) );
+    for (auto it = eqlrng.first; it != eqlrng.second; ++it)
+    {
+        if ( it->second == event.id )
+        {
+            byValue.erase(it);
+            break;
+        }
+    }
+}
+
+
+Catalog::PhaseData::PhaseData(const PhaseData& other)
+    : phases(other.phases), stationIdx(other.stationIdx)
+{
+    buildIndex();
+}
+
+
+Catalog::PhaseIterator
+Catalog::PhaseData::find(unsigned eventId, const std::string& stationId, const Phase::Type& type)
+{
+    auto staIdx = stationIdx.find(stationId);
+    if ( staIdx == stationIdx.end() )
+        return phases.end();
+
+    auto it = byKey.find( PhaseKey{eventId, staIdx->second, type} );
+    return it != byKey.end() ? it->second : phases.end();
+}
+
+
+void Catalog::PhaseData::add(const Phase& phase)
+{
+    PhaseIterator it = phases.emplace(phase.eventId, phase);
+    if ( phases.bucket_count() != bucketCount )
+        buildIndex();
+    else
+        addToIndex(it);
+}
+
+
+void Catalog::PhaseData::removeEvent(unsigned eventId)
+{
+    auto eqlrng = phases.equal_range(eventId);
     for (auto it = eqlrng.first; it != eqlrng.second; ++it)
+        byKey.erase( PhaseKey{it->first, stationIdx.at(it->second.stationId), it->second.procInfo.type} );
+    phases.erase(eqlrng.first, eqlrng.second);
+}
+
+
+void Catalog::PhaseData::buildIndex()
+{
+    byKey.clear();
+    byKey.reserve(phases.size());
+    for (auto it = phases.begin(); it != phases.end(); ++it)
+        addToIndex(it);
+    bucketCount = phases.bucket_count();
+}
+
+
+void Catalog::PhaseData::addToIndex(const PhaseIterator& it)
+{
+    auto staIdx = stationIdx.emplace(it->second.stationId, stationIdx.size()).first;
+    // if several phases share the same key, the first one is indexed
+    byKey.emplace( PhaseKey{it->first, staIdx->second, it->second.procInfo.type}, it );
+}
+
+
+void Catalog::PhaseData::removeFromIndex(const PhaseIterator& it)
+{
+    const PhaseKey key{it->first, stationIdx.at(it->second.stationId), it->second.procInfo.type};
+    auto idx = byKey.find(key);
+    if ( idx == byKey.end() || idx->second != it )
+        return;
+    byKey.erase(idx);
+
+    // index the next phase with the same key, if any
+    auto eqlrng = phases.equal_range(it->first);
+    for (auto other = eqlrng.first; other != eqlrng.second; ++other)
     {
-        const Catalog::Phase& ph = it->second;
-        if ( ph.stationId == stationId && ph.procInfo.type == type )
-            return it;
+        if ( other != it &&
+             other->second.stationId == it->second.stationId &&
+             other->second.procInfo.type == it->second.procInfo.type )
+        {
+            byKey.emplace(key, other);
+            break;
+        }
     }
-    return _phases.end();
 }
 
 
 string Catalog::addStation(const Station& sta)
 {
     string stationId = sta.networkCode + "." + sta.stationCode + "." + sta.locationCode;
-    if ( _stations.find(stationId) == _stations.end() )
+    if ( getStations().find(stationId) == getStations().end() )
     {
         Station newSta = sta;
         newSta.id = stationId;
-        _stations[newSta.id] = newSta;
+        stations()[newSta.id] = newSta;
     }
     return stationId;
 }
@@ -732,17 +887,19 @@ string Catalog::addStation(const Station& sta)
 
 unsigned Catalog::addEvent(const Event& event)
 {
-    decltype(_events)::key_type maxKey = _events.empty() ? 0 : _events.rbegin()->first;
+    EventData& evData = events();
+    unsigned maxKey = evData.events.empty() ? 0 : evData.events.rbegin()->first;
     Event newEvent = event;
     newEvent.id = maxKey + 1;
-    _events[newEvent.id] = newEvent;
+    evData.events[newEvent.id] = newEvent;
+    evData.addToIndex(newEvent);
     return newEvent.id;
 }
 
 
 void Catalog::addPhase(const Phase& phase)
 {
-    _phases.emplace(phase.eventId, phase);
+    phases().add(phase);
 }
 
 void Catalog::writeToFile(string eventFile, string phaseFile, string stationFile) const
@@ -758,7 +915,7 @@ void Catalog::writeToFile(string eventFile, string phaseFile, string stationFile
     evStreamNoReloc << endl;
 
     bool relocInfo = false;
-    for (const auto& kv : _events )
+    for (const auto& kv : getEvents() )
     {
         const Catalog::Event& ev = kv.second;
 
@@ -802,7 +959,7 @@ void Catalog::writeToFile(string eventFile, string phaseFile, string stationFile
     }
     phStream << endl;
 
-    const multimap<unsigned,Catalog::Phase> orderedPhases(_phases.begin(), _phases.end());
+    const multimap<unsigned,Catalog::Phase> orderedPhases(getPhases().begin(), getPhases().end());
     for ( const auto& kv : orderedPhases )
     {
         const Catalog::Phase& ph = kv.second;
@@ -837,7 +994,7 @@ void Catalog::writeToFile(string eventFile, string phaseFile, string stationFile
     ofstream staStream(stationFile);
     staStream << "id,latitude,longitude,elevation,networkCode,stationCode,locationCode" << endl;
 
-    const map<string,Catalog::Station> orderedStations(_stations.begin(), _stations.end());
+    const map<string,Catalog::Station> orderedStations(getStations().begin(), getStations().end());
     for (const auto& kv : orderedStations )
     {
         const Catalog::Station& sta = kv.second;
@@ -19,6 +19,7 @@
 #define __RTDD_APPLICATIONS_CATALOG_H__
 
 #include "datasrc.h"
+#include "interned.h"
 
 #include <seiscomp3/core/baseobject.h>
 #include <seiscomp3/datamodel/eventparameters.h>
@@ -26,7 +27,9 @@
 #include <seiscomp3/datamodel/databasequery.h>
 #include <seiscomp3/datamodel/origin.h>
 
+#include <cstdint>
 #include <unordered_map>
+#include <memory>
 #include <vector>
 
 namespace Seiscomp {
@@ -110,17 +113,19 @@ class Catalog : public Core::BaseObject {
             }
         };
 
+        // the strings are interned: a catalog has millions of phases sharing
+        // few distinct codes
         struct Phase {
             unsigned eventId;
-            std::string stationId;
+            InternedString stationId;
             Core::Time time;
             double lowerUncertainty;
             double upperUncertainty;
-            std::string type;
-            std::string networkCode;
-            std::string stationCode;
-            std::string locationCode;
-            std::string channelCode;
+            InternedString type;
+            InternedString networkCode;
+            InternedString stationCode;
+            InternedString locationCode;
+            InternedString channelCode;
             bool isManual;
 
             enum class Type : char { P='P', S='S' };
@@ -211,15 +216,19 @@ class Catalog : public Core::BaseObject {
         bool updateStation(const Station& newStation, bool addIfMissing=false);
         bool updateEvent(const Event& newEv, bool addIfMissing=false);
         bool updatePhase(const Phase& newPh, bool addIfMissing=false);
+        // replace all the phases of an event with newPhases
+        void replacePhases(unsigned eventId, const std::vector<Phase>& newPhases);
 
-        const std::unordered_map<std::string,Station>& getStations() const { return _stations;}
-        const std::map<unsigned,Event>& getEvents() const { return _events;}
-        const std::unordered_multimap<unsigned,Phase>& getPhases() const { return _phases;}
+        const std::unordered_map<std::string,Station>& getStations() const { return *_stations;}
+        const std::map<unsigned,Event>& getEvents() const { return _events->events;}
+        const std::unordered_multimap<unsigned,Phase>& getPhases() const { return _phases->phases;}
 
         std::unordered_map<std::string,Station>::const_iterator
         searchStation(const std::string& networkCode,
                       const std::string& stationCode,
                       const std::string& locationCode) const;
+        std::unordered_map<std::string,Station>::const_iterator
+        searchStation(const Station&) const;
         std::map<unsigned,Event>::const_iterator searchEvent(const Event&) const;
         std::unordered_map<unsigned,Phase>::const_iterator
         searchPhase(unsigned eventId, const std::string& stationId, const Phase::Type& type) const;
@@ -252,9 +261,81 @@ class Catalog : public Core::BaseObject {
 
     private:
 
-        std::unordered_map<std::string,Station> _stations; // indexed by station id
-        std::map<unsigned,Event> _events; //indexed by event id
-        std::unordered_multimap<unsigned,Phase> _phases; //indexed by event id
+        //
+        // Secondary index of the phases by (event id, station, phase type), so
+        // that searchPhase/updatePhase/removePhase don't scan the event phases
+        // and compare station ids
+        //
+        struct PhaseKey {
+            unsigned eventId;
+            unsigned stationIdx; // see PhaseData::stationIdx
+            Phase::Type type;
+            bool operator==(const PhaseKey& other) const
+            {
+                return eventId == other.eventId &&
+                       stationIdx == other.stationIdx &&
+                       type == other.type;
+            }
+        };
+        struct PhaseKeyHash {
+            size_t operator()(const PhaseKey& key) const
+            {
+                return std::hash<uint64_t>()( (uint64_t(key.eventId) << 32) ^
+                                              (uint64_t(key.stationIdx) << 8) ^
+                                              uint64_t(key.type) );
+            }
+        };
+        typedef std::unordered_multimap<unsigned,Phase>::iterator PhaseIterator;
+
+        typedef std::unordered_map<std::string,Station> StationData; // indexed by station id
+
+        struct EventData {
+            std::map<unsigned,Event> events; //indexed by event id
+            // event value hash -> event id, used by searchEvent
+            std::unordered_multimap<size_t,unsigned> byValue;
+
+            void buildIndex();
+            void addToIndex(const Event& event);
+            void removeFromIndex(const Event& event);
+        };
+
+        struct PhaseData {
+            std::unordered_multimap<unsigned,Phase> phases; //indexed by event id
+            std::unordered_map<std::string,unsigned> stationIdx; // station id -> index
+            std::unordered_map<PhaseKey,PhaseIterator,PhaseKeyHash> byKey;
+            // phases iterators are invalidated by rehashing, in which case the
+            // index is rebuilt
+            size_t bucketCount = 0;
+
+            PhaseData() = default;
+            // the index of a copy refers to the copied phases
+            PhaseData(const PhaseData& other);
+            PhaseData& operator=(const PhaseData& other) = delete;
+
+            void add(const Phase& phase);
+            void removeEvent(unsigned eventId);
+
+            void buildIndex();
+            void addToIndex(const PhaseIterator& it);
+            void removeFromIndex(const PhaseIterator& it);
+            PhaseIterator find(unsigned eventId, const std::string& stationId, const Phase::Type& type);
+        };
+
+        //
+        // The data is shared by the copies of a catalog and duplicated only
+        // when one of them modifies it (copy on write): copying a catalog is
+        // cheap and a catalog derived from another one duplicates only the data
+        // it changes (e.g. the stations are shared by all the catalogs derived
+        // from the background catalog). The pointers are never null
+        //
+        std::shared_ptr<StationData> _stations = std::make_shared<StationData>();
+        std::shared_ptr<EventData> _events = std::make_shared<EventData>();
+        std::shared_ptr<PhaseData> _phases = std::make_shared<PhaseData>();
+
+        // write access: duplicate the data first if shared with other catalogs
+        StationData& stations();
+        EventData& events();
+        PhaseData& phases();
 };
 
 
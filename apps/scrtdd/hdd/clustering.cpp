@@ -20,6 +20,8 @@
 #include "ellipsoid.ipp"
 
 #include <seiscomp3/core/strings.h>
+#include <algorithm>
+#include <cmath>
 
 #define SEISCOMP_COMPONENT RTDD
 #include <seiscomp3/logging/log.h>
@@ -35,6 +37,254 @@ namespace Seiscomp {
 namespace HDD {
 
 
+int
+Neighbours::neighbourIndex(unsigned neighbourId) const
+{
+    auto it = std::lower_bound(_ids.begin(), _ids.end(), neighbourId);
+    if ( it == _ids.end() || *it != neighbourId )
+        return -1;
+    return it - _ids.begin();
+}
+
+
+int
+Neighbours::stationIndex(const string& stationId) const
+{
+    auto it = std::lower_bound(_stations.begin(), _stations.end(), stationId);
+    if ( it == _stations.end() || *it != stationId )
+        return -1;
+    return it - _stations.begin();
+}
+
+
+uint8_t
+Neighbours::phaseTypes(unsigned neighbourId, const string& stationId) const
+{
+    const int neighIdx = neighbourIndex(neighbourId);
+    if ( neighIdx < 0 )
+        return 0;
+    const int staIdx = stationIndex(stationId);
+    if ( staIdx < 0 )
+        return 0;
+
+    auto begin = _records.begin() + _offsets[neighIdx];
+    auto end   = _records.begin() + _offsets[neighIdx + 1];
+    auto it = std::lower_bound(begin, end, uint32_t(staIdx),
+        [](const PhaseRecord& rec, uint32_t idx) { return rec.stationIdx < idx; });
+    if ( it == end || it->stationIdx != uint32_t(staIdx) )
+        return 0;
+    return it->types;
+}
+
+
+void
+Neighbours::add(unsigned neighbourId,
+                const unordered_map<string, set<Phase::Type>>& phases)
+{
+    remove(neighbourId);
+
+    //
+    // store the new station ids and update the existing records to the
+    // new station indices
+    //
+    vector<string> newStations;
+    for ( const auto& kv : phases )
+    {
+        if ( ! kv.second.empty() && stationIndex(kv.first) < 0 )
+            newStations.push_back(kv.first);
+    }
+
+    if ( ! newStations.empty() )
+    {
+        std::sort(newStations.begin(), newStations.end());
+        vector<string> stations;
+        stations.reserve(_stations.size() + newStations.size());
+        std::merge(_stations.begin(), _stations.end(),
+                   newStations.begin(), newStations.end(), std::back_inserter(stations));
+
+        vector<uint32_t> newIndex(_stations.size());
+        for ( uint32_t oldIdx = 0, newIdx = 0; oldIdx < _stations.size(); newIdx++ )
+        {
+            if ( stations[newIdx] == _stations[oldIdx] )
+                newIndex[oldIdx++] = newIdx;
+        }
+        for ( PhaseRecord& rec : _records )
+            rec.stationIdx = newIndex[rec.stationIdx];
+
+        _stations.swap(stations);
+    }
+
+    //
+    // add the neighbour records
+    //
+    vector<PhaseRecord> records;
+    for ( const auto& kv : phases )
+    {
+        PhaseRecord rec;
+        rec.stationIdx = stationIndex(kv.first);
+        rec.types = 0;
+        for ( Phase::Type type : kv.second )
+            rec.types |= typeBit(type);
+        if ( rec.types != 0 )
+            records.push_back(rec);
+    }
+    std::sort(records.begin(), records.end(),
+        [](const PhaseRecord& a, const PhaseRecord& b) { return a.stationIdx < b.stationIdx; });
+
+    const unsigned neighIdx = std::lower_bound(_ids.begin(), _ids.end(), neighbourId) - _ids.begin();
+    _ids.insert(_ids.begin() + neighIdx, neighbourId);
+    _records.insert(_records.begin() + _offsets[neighIdx], records.begin(), records.end());
+    _offsets.insert(_offsets.begin() + neighIdx + 1, _offsets[neighIdx] + records.size());
+    for ( unsigned i = neighIdx + 2; i < _offsets.size(); i++ )
+        _offsets[i] += records.size();
+}
+
+
+void
+Neighbours::remove(unsigned neighbourId)
+{
+    const int neighIdx = neighbourIndex(neighbourId);
+    if ( neighIdx < 0 )
+        return;
+
+    // the station ids are kept, even if they are not used anymore
+    const unsigned numRecords = _offsets[neighIdx + 1] - _offsets[neighIdx];
+    _records.erase(_records.begin() + _offsets[neighIdx],
+                   _records.begin() + _offsets[neighIdx + 1]);
+    _offsets.erase(_offsets.begin() + neighIdx + 1);
+    for ( unsigned i = neighIdx + 1; i < _offsets.size(); i++ )
+        _offsets[i] -= numRecords;
+    _ids.erase(_ids.begin() + neighIdx);
+}
+
+
+vector<pair<string, Phase::Type>>
+Neighbours::allPhases() const
+{
+    vector<uint8_t> typesByStation(_stations.size(), 0);
+    for ( const PhaseRecord& rec : _records )
+        typesByStation[rec.stationIdx] |= rec.types;
+
+    vector<pair<string, Phase::Type>> allPhases;
+    for ( unsigned staIdx = 0; staIdx < _stations.size(); staIdx++ )
+    {
+        for ( Phase::Type type : {Phase::Type::P, Phase::Type::S} )
+        {
+            if ( typesByStation[staIdx] & typeBit(type) )
+                allPhases.emplace_back(_stations[staIdx], type);
+        }
+    }
+    return allPhases;
+}
+
+
+EventSpatialIndex::EventSpatialIndex(double cellSize)
+{
+    // the longitude cells must wrap around exactly at 360 degrees
+    _numLonCells = std::max(1, int(std::ceil(360. / Math::Geo::km2deg(cellSize))));
+    _cellSize = 360. / _numLonCells;
+}
+
+
+EventSpatialIndex::EventSpatialIndex(const Catalog& catalog, double cellSize)
+    : EventSpatialIndex(cellSize)
+{
+    for (const auto& kv : catalog.getEvents() )
+        add(kv.second);
+}
+
+
+int EventSpatialIndex::latCell(double lat) const
+{
+    return int(std::floor((lat + 90.) / _cellSize));
+}
+
+
+int EventSpatialIndex::lonCell(double lon) const
+{
+    int cell = int(std::floor((lon + 180.) / _cellSize)) % _numLonCells;
+    return cell < 0 ? cell + _numLonCells : cell;
+}
+
+
+uint64_t EventSpatialIndex::cellKey(int latCell, int lonCell) const
+{
+    return (uint64_t(uint32_t(latCell)) << 32) | uint32_t(lonCell);
+}
+
+
+void EventSpatialIndex::add(const Catalog::Event& event)
+{
+    remove(event.id);
+    uint64_t key = cellKey(latCell(event.latitude), lonCell(event.longitude));
+    _cells[key].push_back(event.id);
+    _cellByEvent[event.id] = key;
+}
+
+
+void EventSpatialIndex::remove(unsigned eventId)
+{
+    auto it = _cellByEvent.find(eventId);
+    if ( it == _cellByEvent.end() )
+        return;
+    vector<unsigned>& cell = _cells[it->second];
+    cell.erase(std::find(cell.begin(), cell.end(), eventId));
+    if ( cell.empty() )
+        _cells.erase(it->second);
+    _cellByEvent.erase(it);
+}
+
+
+void EventSpatialIndex::clear()
+{
+    _cells.clear();
+    _cellByEvent.clear();
+}
+
+
+vector<unsigned>
+EventSpatialIndex::query(double lat, double lon, double distance) const
+{
+    // Bounding box of the spherical cap centered at lat/lon: the latitude
+    // difference never exceeds the angular distance, while the longitude
+    // difference is bounded unless the cap contains a pole. The small margin
+    // accounts for rounding, since the candidates are checked later anyway
+    const double angle = Math::Geo::km2deg(std::max(distance, 0.)) * 1.01 + 1e-6;
+    const double minLat = lat - angle, maxLat = lat + angle;
+
+    double lonRange = 180;
+    if ( minLat > -90 && maxLat < 90 )
+    {
+        double ratio = std::sin(deg2rad(angle)) / std::cos(deg2rad(lat));
+        if ( ratio < 1 )
+            lonRange = rad2deg(std::asin(ratio));
+    }
+
+    int firstLonCell = 0, numLonCells = _numLonCells;
+    if ( lonRange < 180 )
+    {
+        firstLonCell = int(std::floor((lon - lonRange + 180.) / _cellSize));
+        numLonCells = int(std::floor((lon + lonRange + 180.) / _cellSize)) - firstLonCell + 1;
+        numLonCells = std::min(numLonCells, _numLonCells);
+    }
+
+    vector<unsigned> ids;
+    for ( int latC = latCell(std::max(minLat, -90.)); latC <= latCell(std::min(maxLat, 90.)); latC++ )
+    {
+        for ( int i = 0; i < numLonCells; i++ )
+        {
+            int lonC = (firstLonCell + i) % _numLonCells;
+            if ( lonC < 0 ) lonC += _numLonCells;
+            auto it = _cells.find(cellKey(latC, lonC));
+            if ( it != _cells.end() )
+                ids.insert(ids.end(), it->second.begin(), it->second.end());
+        }
+    }
+    std::sort(ids.begin(), ids.end());
+    return ids;
+}
+
+
 NeighboursPtr
 selectNeighbouringEvents(const CatalogCPtr& catalog,
                          const Event& refEv,
@@ -49,7 +299,10 @@ selectNeighbouringEvents(const CatalogCPtr& catalog,
                          int maxNumNeigh,
                          int numEllipsoids,
                          double maxEllipsoidSize,
-                         bool keepUnmatched)
+                         bool keepUnmatched,
+                         const EventSpatialIndexCPtr& catalogIndex,
+                         const DistanceCachePtr& distanceCache,
+                         CandidateScan *candidateScan)
 {
     SEISCOMP_INFO("Selecting Neighbouring Events for event %s lat %.6f lon %.6f depth %.4f mag %.2f time %s",
                    string(refEv).c_str(), refEv.latitude, refEv.longitude, refEv.depth,
@@ -84,16 +337,65 @@ selectNeighbouringEvents(const CatalogCPtr& catalog,
     unordered_map<unsigned,double> distanceByEvent; // eventid, distance
     unordered_map<unsigned,double> azimuthByEvent;  // eventid, azimuth
 
-    for (const auto& kv : catalog->getEvents() )
+    // With an index only the events within the horizontal extent of the
+    // outmost ellipsoid are considered; they are visited in the same
+    // (id) order as the catalog, so the selection doesn't change
+    const Ellipsoid& outmostEllip = ellipsoids[0]->getOuterEllipsoid();
+    vector<const Event*> candidates;
+    if ( catalogIndex )
     {
-        const Event& event = kv.second;
+        const double radius = std::max(outmostEllip.axis_a, outmostEllip.axis_b);
+
+        vector<unsigned> queried;
+        const vector<unsigned> *candidateIds = &queried;
+        if ( ! candidateScan )
+        {
+            queried = catalogIndex->query(refEv.latitude, refEv.longitude, radius);
+        }
+        else
+        {
+            // the previous candidates cover this area if it is within their radius
+            const double shift = computeDistance(candidateScan->latitude, candidateScan->longitude, 0,
+                                                 refEv.latitude, refEv.longitude, 0);
+            if ( candidateScan->radius >= 0 && shift + radius <= candidateScan->radius )
+            {
+                SEISCOMP_DEBUG("Reusing the %lu candidate events found by the previous selection",
+                               candidateScan->eventIds.size());
+            }
+            else
+            {
+                candidateScan->latitude = refEv.latitude;
+                candidateScan->longitude = refEv.longitude;
+                candidateScan->radius = radius + candidateScan->margin;
+                candidateScan->eventIds = catalogIndex->query(refEv.latitude, refEv.longitude,
+                                                              candidateScan->radius);
+            }
+            candidateIds = &candidateScan->eventIds;
+        }
+
+        for ( unsigned evId : *candidateIds )
+        {
+            auto it = catalog->getEvents().find(evId);
+            if ( it != catalog->getEvents().end() )
+                candidates.push_back(&it->second);
+        }
+    }
+    else
+    {
+        candidates.reserve(catalog->getEvents().size());
+        for (const auto& kv : catalog->getEvents() )
+            candidates.push_back(&kv.second);
+    }
+
+    for (const Event* candidate : candidates )
+    {
+        const Event& event = *candidate;
 
         if (event == refEv)
             continue;
 
         // drop event if outside the outmost ellipsod boundaries
-        HddEllipsoidPtr outmostEllip = ellipsoids[0];
-        if ( ! outmostEllip->getOuterEllipsoid().isInside(event.latitude, event.longitude, event.depth) )
+        if ( ! outmostEllip.isInside(event.latitude, event.longitude, event.depth) )
             continue;
 
         // compute distance between current event and reference origin
@@ -115,7 +417,8 @@ selectNeighbouringEvents(const CatalogCPtr& catalog,
         const Station& station = kv.second;
 
         // compute distance between reference event and station
-        double staRefEvDistance = computeDistance(refEv, station);
+        double staRefEvDistance = distanceCache ? distanceCache->compute(refEv, station)
+                                                : computeDistance(refEv, station);
 
         // check this station distance is ok
         if ( ( maxESdist <= 0 || staRefEvDistance <= maxESdist ) ||  // too far away ?
@@ -175,7 +478,8 @@ selectNeighbouringEvents(const CatalogCPtr& catalog,
             if ( maxESdist > 0 )
             {
                 // compute distance between current event and station
-                double stationDistance = computeDistance(event, station);
+                double stationDistance = distanceCache ? distanceCache->compute(event, station)
+                                                       : computeDistance(event, station);
 
                 if ( ( stationDistance > maxESdist )                 ||      // too far away ?
                      ( stationDistance < minESdist )                 ||       // too close ?
@@ -268,8 +572,7 @@ selectNeighbouringEvents(const CatalogCPtr& catalog,
             const Event& ev = evSelEntry.event;
 
             // add this event to the catalog
-            neighboringEventCat->ids.insert( ev.id );
-            neighboringEventCat->phases[ ev.id ] = evSelEntry.phases;
+            neighboringEventCat->add( ev.id, evSelEntry.phases );
             neighboringEventCat->numNeighbours++;
 
             SEISCOMP_INFO("Neighbour: #obsers %2d distance %5.2f azimuth %3.f "
@@ -285,49 +588,91 @@ selectNeighbouringEvents(const CatalogCPtr& catalog,
         //
         // Apply Waldauser's concentric ellipsoids algorithm
         //
-        vector<int> quadrants = {1,2,3,4,5,6,7,8};
+        // Each selected event is classified once: it belongs to one ellipsoidal layer
+        // and to one or more quadrants (more than one when it lies on a quadrant
+        // boundary). Each (layer, quadrant) pair then gets the queue of its events,
+        // sorted by distance as selectedEvents, from which the closest is picked
+        //
+        const unsigned numQuadrants = 8;
+        vector<const SelectedEventEntry*> entries;
+        vector<vector<unsigned>> queues(ellipsoids.size() * numQuadrants); // entries indices
+
+        for (const auto& kv : selectedEvents)
+        {
+            const Event& ev = kv.second.event;
+
+            double dist_x, dist_y, dist_z;
+            outmostEllip.localOffsets(ev.latitude, ev.longitude, ev.depth, dist_x, dist_y, dist_z);
+
+            int layer = -1;
+            for (int elpsNum = 0; elpsNum < int(ellipsoids.size()); elpsNum++)
+            {
+                if ( ellipsoids[elpsNum]->isInsideOffsets(dist_x, dist_y, dist_z) )
+                {
+                    layer = elpsNum;
+                    break;
+                }
+            }
+            if ( layer < 0 )
+                continue;
+
+            const unsigned quadrants = HddEllipsoid::quadrantMask(
+                outmostEllip, ev.latitude, ev.longitude, ev.depth);
+
+            for (unsigned q = 0; q < numQuadrants; q++)
+            {
+                if ( quadrants & (1u << q) )
+                    queues[layer * numQuadrants + q].push_back( entries.size() );
+            }
+            entries.push_back( &kv.second );
+        }
+
+        vector<bool> taken(entries.size(), false);
+        vector<unsigned> queueHeads(queues.size(), 0);
+        unsigned numAvailable = entries.size();
         bool workToDo = true;
 
         while ( workToDo )
         {
             for(int elpsNum = ellipsoids.size() -1; elpsNum >= 0;  elpsNum--)
             {
-                for (int quadrant : quadrants)
+                for (unsigned quadrant = 1; quadrant <= numQuadrants; quadrant++)
                 {
                     // if we don't have events or we have already selected maxNumNeigh neighbors exit
-                    if ( selectedEvents.empty() ||
+                    if ( numAvailable == 0 ||
                         (maxNumNeigh > 0 && neighboringEventCat->numNeighbours >= maxNumNeigh) )
                     {
                         workToDo = false;
                         break;
                     }
 
-                    // since selectedEvents is sorted by distance we get closer events first
-                    for (auto it = selectedEvents.begin(); it != selectedEvents.end(); it++)
-                    {
-                        const SelectedEventEntry& evSelEntry = it->second;
-                        const Event& ev = evSelEntry.event;
-
-                        bool found = ellipsoids[elpsNum]->isInside(ev.latitude, ev.longitude,
-                                                                   ev.depth, quadrant);
-                        if ( found )
-                        {
-                            // add this event to the catalog
-                            neighboringEventCat->ids.insert( ev.id );
-                            neighboringEventCat->phases[ ev.id ] = evSelEntry.phases;
-
-                            neighboringEventCat->numNeighbours++;
-                            selectedEvents.erase(it);
-
-                            SEISCOMP_INFO("Neighbour: ellipsoid %2d quadrant %d #observs %2d "
-                              "distance %5.2f azimuth %3.f depth-diff %6.3f depth %5.3f event %s ",
-                              elpsNum, quadrant, dtCountByEvent[ev.id], distanceByEvent[ev.id],
-                              azimuthByEvent[ev.id], refEv.depth-ev.depth, ev.depth,
-                              string(ev).c_str() );
-
-                            break;
-                        }
-                    }
+                    // skip the events already picked from another quadrant
+                    const unsigned queueIdx = elpsNum * numQuadrants + quadrant - 1;
+                    const vector<unsigned>& queue = queues[queueIdx];
+                    unsigned& head = queueHeads[queueIdx];
+                    while ( head < queue.size() && taken[ queue[head] ] )
+                        head++;
+
+                    if ( head == queue.size() )
+                        continue;
+
+                    const unsigned entryIdx = queue[head++];
+                    taken[entryIdx] = true;
+                    numAvailable--;
+
+                    const SelectedEventEntry& evSelEntry = *entries[entryIdx];
+                    const Event& ev = evSelEntry.event;
+
+                    // add this event to the catalog
+                    neighboringEventCat->add( ev.id, evSelEntry.phases );
+
+                    neighboringEventCat->numNeighbours++;
+
+                    SEISCOMP_INFO("Neighbour: ellipsoid %2d quadrant %d #observs %2d "
+                      "distance %5.2f azimuth %3.f depth-diff %6.3f depth %5.3f event %s ",
+                      elpsNum, quadrant, dtCountByEvent[ev.id], distanceByEvent[ev.id],
+                      azimuthByEvent[ev.id], refEv.depth-ev.depth, ev.depth,
+                      string(ev).c_str() );
                 }
             }
         }
@@ -359,93 +704,101 @@ selectNeighbouringEventsCatalog(const CatalogCPtr& catalog,
                                 int maxNumNeigh,
                                 int numEllipsoids,
                                 double maxEllipsoidSize,
-                                bool keepUnmatched)
+                                bool keepUnmatched,
+                                unsigned numThreads,
+                                const DistanceCachePtr& distanceCache)
 {
     SEISCOMP_INFO("Selecting Catalog Neighbouring Events ");
 
-    // neighbours for each event
-    list<NeighboursPtr> neighboursByEvent;
+    // neighbours for each event, indexed by reference event id
+    map<unsigned,NeighboursPtr> neighboursByEvent;
+
+    // for each event the reference events that selected it as neighbour
+    unordered_map<unsigned, unordered_set<unsigned>> referencedBy;
 
-    // for each event find the neighbours
     CatalogPtr validCatalog = new Catalog(*catalog);
-    list<unsigned> todoEvents;
+    EventSpatialIndexPtr validCatalogIndex = new EventSpatialIndex(*validCatalog);
+
+    // const references for the worker threads: the smart pointers
+    // reference counting is not thread safe, so don't copy them there
+    const CatalogCPtr constCatalog = validCatalog;
+    const EventSpatialIndexCPtr constCatalogIndex = validCatalogIndex;
+
+    vector<unsigned> todoEvents;
     for (const auto& kv : validCatalog->getEvents() )
         todoEvents.push_back( kv.first );
 
+    //
+    // Events that don't satisfy the requirements are removed from the catalog and
+    // only the events that selected them as neighbour are computed again. Removing
+    // an event can only reduce the neighbours of the others, so this converges to
+    // the same result as restarting the whole selection after each removal
+    //
     while ( ! todoEvents.empty() )
     {
-        list<NeighboursPtr> newNeighbourCats;
-        vector<unsigned> removedEvents;
+        // the selection only reads the catalog, so the events can be processed in parallel
+        vector<NeighboursPtr> newNeighbours(todoEvents.size());
 
-        // for each event find the neighbours
-        for (unsigned evIdTodo : todoEvents )
+        auto selectKernel = [&](unsigned begin, unsigned end)
         {
-            Catalog::Event event = validCatalog->getEvents().find(evIdTodo)->second;
-
-            NeighboursPtr neighbours;
-            try {
-                neighbours = selectNeighbouringEvents(
-                    validCatalog, event, validCatalog,  minPhaseWeight, minESdist, maxESdist,
-                    minEStoIEratio, minDTperEvt, maxDTperEvt,  minNumNeigh, maxNumNeigh,
-                    numEllipsoids, maxEllipsoidSize, keepUnmatched
-                );
-            } catch ( ... ) { }
-
-            if ( ! neighbours )
+            for (unsigned i = begin; i < end; i++)
             {
-                // event discarded because it doesn't satisfies requirements
-                removedEvents.push_back( event.id );
-                // next loop we don't want other events to pick this as neighbour
-                validCatalog->removeEvent( event.id );
-                todoEvents.remove( event.id ); // this invalidates the loop !
-                // stop here because we dont' want to keep building potentially wrong neighbours
-                break;
+                const Event& event = constCatalog->getEvents().at(todoEvents[i]);
+                try {
+                    newNeighbours[i] = selectNeighbouringEvents(
+                        constCatalog, event, constCatalog,  minPhaseWeight, minESdist, maxESdist,
+                        minEStoIEratio, minDTperEvt, maxDTperEvt,  minNumNeigh, maxNumNeigh,
+                        numEllipsoids, maxEllipsoidSize, keepUnmatched, constCatalogIndex,
+                        distanceCache
+                    );
+                } catch ( ... ) { }
+            }
+        };
+        parallelFor(todoEvents.size(), numThreads, 1, selectKernel);
+
+        vector<unsigned> removedEvents;
+        for (unsigned i = 0; i < todoEvents.size(); i++)
+        {
+            const unsigned evId = todoEvents[i];
+            if ( ! newNeighbours[i] )
+            {
+                // event discarded because it doesn't satisfies requirements:
+                // we don't want other events to pick this as neighbour
+                removedEvents.push_back( evId );
+                validCatalog->removeEvent( evId );
+                validCatalogIndex->remove( evId );
+                continue;
             }
 
-            newNeighbourCats.push_back(neighbours);
+            for ( unsigned neighEvId : newNeighbours[i]->ids() )
+                referencedBy[neighEvId].insert( evId );
+            neighboursByEvent[evId] = newNeighbours[i];
         }
 
-        // add newly computed neighbors catalogs to previous ones
-        for ( NeighboursPtr& neighbours : newNeighbourCats )
+        // rebuild the neighbours of the events that were using a removed event
+        set<unsigned> redoEvents;
+        for ( unsigned removedEventId : removedEvents )
         {
-            neighboursByEvent.push_back( neighbours );
-            // make sure we won't recompute what has been already done
-            todoEvents.remove( neighbours->refEvId );
+            auto it = referencedBy.find( removedEventId );
+            if ( it == referencedBy.end() )
+                continue;
+            redoEvents.insert( it->second.begin(), it->second.end() );
+            referencedBy.erase( it );
         }
 
-        // check if the removed events were used as neighbour of any other event
-        // if so rebuild neighbours for those events
-        bool redo;
-        do {
-            redo = false;
-            list<NeighboursPtr> validNeighbourCats;
-
-            for ( NeighboursPtr& neighbours : neighboursByEvent )
+        for ( unsigned evId : redoEvents )
+        {
+            auto it = neighboursByEvent.find( evId );
+            for ( unsigned neighEvId : it->second->ids() )
             {
-                bool currCatInvalid = false;
-                for (unsigned removedEventId : removedEvents)
-                {
-                    if( neighbours->ids.count( removedEventId ) != 0 )
-                    {
-                        currCatInvalid = true;
-                        break;
-                    }
-                }
-
-                if ( currCatInvalid )
-                {
-                    removedEvents.push_back( neighbours->refEvId );
-                    todoEvents.push_back( neighbours->refEvId );
-                    redo = true;
-                    continue;
-                }
-                validNeighbourCats.push_back( neighbours );
+                auto refIt = referencedBy.find( neighEvId );
+                if ( refIt != referencedBy.end() )
+                    refIt->second.erase( evId );
             }
+            neighboursByEvent.erase( it );
+        }
 
-            neighboursByEvent.clear();
-            neighboursByEvent = validNeighbourCats;
-
-        } while( redo );
+        todoEvents.assign( redoEvents.begin(), redoEvents.end() );
     }
 
     // We don't want to report the same pairs multiple times
@@ -453,27 +806,30 @@ selectNeighbouringEventsCatalog(const CatalogCPtr& catalog,
     // remove the pairs that appeared in previous catalogs from
     // the following catalogs
     std::unordered_multimap<unsigned,unsigned> existingPairs;
+    list<NeighboursPtr> neighboursList;
 
-    for ( NeighboursPtr& neighbours : neighboursByEvent )
+    for ( const auto& kv : neighboursByEvent )
     {
+        const NeighboursPtr& neighbours = kv.second;
         unsigned currEventId = neighbours->refEvId;
 
         // remove from currrent catalog the existing pairs
         auto eqlrng = existingPairs.equal_range(currEventId );
         for (auto existingPair = eqlrng.first; existingPair != eqlrng.second; existingPair++)
         {
-            neighbours->ids.erase( existingPair->second );
-            neighbours->phases.erase( existingPair->second );
+            neighbours->remove( existingPair->second );
         }
 
         // remove current pairs from following catalogs
-        for ( unsigned neighEvId : neighbours->ids )
+        for ( unsigned neighEvId : neighbours->ids() )
         {
             existingPairs.emplace(neighEvId, currEventId);
         }
+
+        neighboursList.push_back( neighbours );
     }
 
-    return neighboursByEvent;
+    return neighboursList;
 }
 
 
@@ -19,10 +19,13 @@
 #define __RTDD_APPLICATIONS_CLUSTERING_H__
 
 #include "catalog.h"
+#include "distcache.h"
 #include <seiscomp3/core/baseobject.h>
 #include <unordered_map>
 #include <unordered_set>
 #include <set>
+#include <vector>
+#include <cstdint>
 
 
 namespace Seiscomp {
@@ -30,61 +33,131 @@ namespace HDD {
 
 DEFINE_SMARTPOINTER(Neighbours);
 
-// DD background catalog
+/*
+ * Neighbouring events of a reference event and the phases (station and phase
+ * type) of each neighbour to be used for the double-difference observations.
+ *
+ * The data is kept in flat sorted arrays, since many of those objects are
+ * alive at the same time in multi-event relocations: the neighbour ids, the
+ * station ids (each stored once) and, for each neighbour, its records of
+ * station index and phase types bitmask sorted by station index.
+ */
 struct Neighbours : public Core::BaseObject
 {
     unsigned refEvId;
 
     unsigned numNeighbours;
 
-    std::unordered_set<unsigned> ids; // neighbouring event id 
+    // neighbouring event ids, sorted
+    const std::vector<unsigned>& ids() const { return _ids; }
 
-    std::unordered_map<unsigned, // indexed by event id
-         std::unordered_map<std::string, // indexed by station id
-                            std::set<Catalog::Phase::Type> > > phases;
+    // add a neighbour and its phases (replacing the existing ones, if any)
+    void add(unsigned neighbourId,
+             const std::unordered_map<std::string, std::set<Catalog::Phase::Type>>& phases);
 
-    std::unordered_map<std::string, std::set<Catalog::Phase::Type> > allPhases() const
-    {
-         std::unordered_map<std::string, std::set<Catalog::Phase::Type> > allPhases;
-         for ( const auto& kw1 : phases )
-            for ( const auto& kw2 : kw1.second )
-                 allPhases[kw2.first].insert(kw2.second.begin(), kw2.second.end());
-         return allPhases;
-    }
+    void remove(unsigned neighbourId);
+
+    // station ids and phase types of all the neighbours phases, sorted by station id
+    std::vector<std::pair<std::string, Catalog::Phase::Type>> allPhases() const;
 
     bool has(unsigned neighbourId) const
     {
-        return ids.find(neighbourId) != ids.end();
+        return neighbourIndex(neighbourId) >= 0;
     }
 
-    bool has(unsigned neighbourId, const std::string stationId) const
+    bool has(unsigned neighbourId, const std::string& stationId) const
     {
-        const auto& neighPhases = phases.find(neighbourId);
-        if ( neighPhases != phases.end() )
-            return neighPhases->second.find(stationId) != neighPhases->second.end();
-        return false;
+        return phaseTypes(neighbourId, stationId) != 0;
     }
 
-    bool has(unsigned neighbourId, const std::string stationId, Catalog::Phase::Type type) const
+    bool has(unsigned neighbourId, const std::string& stationId, Catalog::Phase::Type type) const
     {
-        const auto& neighPhases = phases.find(neighbourId);
-        if ( neighPhases != phases.end() ) {
-            const auto& neighPhaseTypes = neighPhases->second.find(stationId);
-            if ( neighPhaseTypes != neighPhases->second.end() )
-                return  neighPhaseTypes->second.find(type) != neighPhaseTypes->second.end();
-        }
-        return false;
-    } 
+        return ( phaseTypes(neighbourId, stationId) & typeBit(type) ) != 0;
+    }
 
     CatalogPtr fromNeighbours(const CatalogCPtr& catalog, bool includeRefEv=false) const
     {
         CatalogPtr returnCat( new Catalog() );
-        for (unsigned neighbourId : ids)
+        for (unsigned neighbourId : _ids)
             returnCat->add(neighbourId, *catalog, true);
         if ( includeRefEv )
             returnCat->add(refEvId, *catalog, true);
         return returnCat;
     }
+
+private:
+    struct PhaseRecord {
+        uint32_t stationIdx;
+        uint8_t types; // Catalog::Phase::Type bitmask
+    };
+
+    static uint8_t typeBit(Catalog::Phase::Type type)
+    {
+        return type == Catalog::Phase::Type::P ? 0x1 : 0x2;
+    }
+
+    int neighbourIndex(unsigned neighbourId) const;
+    int stationIndex(const std::string& stationId) const;
+    uint8_t phaseTypes(unsigned neighbourId, const std::string& stationId) const;
+
+    std::vector<unsigned> _ids;          // sorted
+    std::vector<std::string> _stations;  // sorted, PhaseRecord::stationIdx refers to this
+    std::vector<PhaseRecord> _records;   // grouped by neighbour (in _ids order)
+    std::vector<unsigned> _offsets = {0}; // records of _ids[i] are [_offsets[i], _offsets[i+1])
+};
+
+
+DEFINE_SMARTPOINTER(EventSpatialIndex);
+
+/*
+ * Spatial index of catalog events used to find the neighbour candidates
+ * without scanning the whole catalog. The events are binned in a uniform
+ * grid of latitude/longitude cells; the index has to be kept up to date
+ * with the catalog it is used with (see add/remove)
+ */
+class EventSpatialIndex : public Core::BaseObject
+{
+public:
+    explicit EventSpatialIndex(double cellSize = 5. /* km */);
+    EventSpatialIndex(const Catalog& catalog, double cellSize = 5. /* km */);
+
+    void add(const Catalog::Event& event);
+    void remove(unsigned eventId);
+    void clear();
+    unsigned size() const { return _cellByEvent.size(); }
+
+    /*
+     * Return the ids (sorted) of the events within 'distance' km
+     * (horizontal distance) from lat/lon plus possibly some further ones
+     */
+    std::vector<unsigned> query(double lat, double lon, double distance) const;
+
+private:
+    int latCell(double lat) const;
+    int lonCell(double lon) const;
+    uint64_t cellKey(int latCell, int lonCell) const;
+
+    double _cellSize; // degrees
+    int _numLonCells;
+    std::unordered_map<uint64_t, std::vector<unsigned>> _cells; // event ids by cell
+    std::unordered_map<unsigned, uint64_t> _cellByEvent;
+};
+
+/*
+ * Candidate events found by the spatial index for a neighbours selection:
+ * eventIds (sorted) are the events within 'radius' km (horizontal distance)
+ * from latitude/longitude, plus possibly some further ones. A following
+ * selection on the same catalog and around a close location (e.g. step 2
+ * of a single event relocation) filters these candidates instead of querying
+ * the index again, unless it needs a wider area. The index is queried 'margin'
+ * km further than required, so that the candidates still cover a location
+ * that moved by up to that distance
+ */
+struct CandidateScan {
+    double latitude = 0, longitude = 0;
+    double radius = -1; // km, < 0 when there are no candidates yet
+    double margin = 2;  // km
+    std::vector<unsigned> eventIds;
 };
 
 
@@ -102,7 +175,10 @@ selectNeighbouringEvents(const CatalogCPtr& catalog,
                          int maxNumNeigh=-1,
                          int numEllipsoids=5,
                          double maxEllipsoidSize=10,
-                         bool keepUnmatched=false);
+                         bool keepUnmatched=false,
+                         const EventSpatialIndexCPtr& catalogIndex=nullptr,
+                         const DistanceCachePtr& distanceCache=nullptr,
+                         CandidateScan *candidateScan=nullptr);
 
 std::list<NeighboursPtr>
 selectNeighbouringEventsCatalog(const CatalogCPtr& catalog,
@@ -116,7 +192,9 @@ selectNeighbouringEventsCatalog(const CatalogCPtr& catalog,
                                 int maxNumNeigh,
                                 int numEllipsoids,
                                 double maxEllipsoidSize,
-                                bool keepUnmatched);
+                                bool keepUnmatched,
+                                unsigned numThreads=1,
+                                const DistanceCachePtr& distanceCache=nullptr);
 
 }
 }
@@ -0,0 +1,223 @@
+/***************************************************************************
+ *   Copyright (C) by ETHZ/SED                                             *
+ *                                                                         *
+ * This program is free software: you can redistribute it and/or modify    *
+ * it under the terms of the GNU Affero General Public License as published*
+ * by the Free Software Foundation, either version 3 of the License, or    *
+ * (at your option) any later version.                                     *
+ *                                                                         *
+ * This program is distributed in the hope that it will be useful,         *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of          *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           *
+ * GNU Affero General Public License for more details.                     *
+ *                                                                         *
+ *                                                                         *
+ *   Developed by Luca Scarabello <luca.scarabello@sed.ethz.ch>            *
+ ***************************************************************************/
+
+#include "distcache.h"
+#include "utils.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+using namespace std;
+using Event = Seiscomp::HDD::Catalog::Event;
+using Station = Seiscomp::HDD::Catalog::Station;
+
+namespace Seiscomp {
+namespace HDD {
+
+
+DistanceCache::DistanceCache(unsigned maxEntries)
+    : _maxShardEntries(std::max(maxEntries / NumShards, 1u))
+{ }
+
+
+void
+DistanceCache::invalidate(unsigned eventId)
+{
+    Shard& sh = shard(eventId);
+    std::lock_guard<std::mutex> lock(sh.mutex);
+    auto it = sh.events.find(eventId);
+    if ( it != sh.events.end() )
+    {
+        for ( const Value& value : it->second.stations )
+            if ( ! std::isnan(value.distance) ) sh.entries--;
+        sh.entries -= it->second.events.size();
+        sh.events.erase(it);
+    }
+}
+
+
+void
+DistanceCache::clear()
+{
+    for ( Shard& sh : _shards )
+    {
+        std::lock_guard<std::mutex> lock(sh.mutex);
+        sh.events.clear();
+        sh.stationIdx.clear();
+        sh.stationLocations.clear();
+        sh.entries = sh.hits = sh.misses = 0;
+    }
+}
+
+
+DistanceCache::Stats
+DistanceCache::stats() const
+{
+    Stats stats( {0, 0, 0} );
+    for ( const Shard& sh : _shards )
+    {
+        std::lock_guard<std::mutex> lock(sh.mutex);
+        stats.entries += sh.entries;
+        stats.hits    += sh.hits;
+        stats.misses  += sh.misses;
+    }
+    return stats;
+}
+
+
+/*
+ * Drop all the events of the shard when it is full. The shard mutex
+ * must be held by the caller
+ */
+void
+DistanceCache::makeRoom(Shard& sh)
+{
+    if ( sh.entries >= _maxShardEntries )
+    {
+        sh.events.clear();
+        sh.entries = 0;
+    }
+}
+
+
+/*
+ * Return the entry of event, discarding the cached values if the
+ * event location changed. The shard mutex must be held by the caller
+ */
+DistanceCache::EventEntry&
+DistanceCache::eventEntry(Shard& sh, const Event& event)
+{
+    const Location location( {event.latitude, event.longitude, event.depth} );
+
+    auto it = sh.events.find(event.id);
+    if ( it == sh.events.end() )
+    {
+        EventEntry& entry = sh.events[event.id];
+        entry.location = location;
+        return entry;
+    }
+
+    EventEntry& entry = it->second;
+    if ( entry.location == location )
+        return entry;
+
+    for ( const Value& value : entry.stations )
+        if ( ! std::isnan(value.distance) ) sh.entries--;
+    sh.entries -= entry.events.size();
+
+    entry.location = location;
+    entry.stations.clear();
+    entry.events.clear();
+    return entry;
+}
+
+
+/*
+ * Return the shard index of station. A station whose location changed gets
+ * a new index, so that the values computed for the old location are not
+ * used anymore. The shard mutex must be held by the caller
+ */
+unsigned
+DistanceCache::stationIndex(Shard& sh, const Station& station)
+{
+    const Location location( {station.latitude, station.longitude,
+                              -(station.elevation/1000.)} );
+
+    auto it = sh.stationIdx.find(station.id);
+    if ( it != sh.stationIdx.end() && sh.stationLocations[it->second] == location )
+        return it->second;
+
+    const unsigned staIdx = sh.stationLocations.size();
+    sh.stationLocations.push_back(location);
+    sh.stationIdx[station.id] = staIdx;
+    return staIdx;
+}
+
+
+double
+DistanceCache::compute(const Event& event, const Station& station, double *azimuth)
+{
+    Shard& sh = shard(event.id);
+    std::lock_guard<std::mutex> lock(sh.mutex);
+    makeRoom(sh);
+
+    const unsigned staIdx = stationIndex(sh, station);
+    EventEntry& entry = eventEntry(sh, event);
+
+    if ( entry.stations.size() <= staIdx )
+    {
+        entry.stations.resize(staIdx + 1,
+            Value( {std::numeric_limits<double>::quiet_NaN(), 0} ));
+    }
+
+    Value& value = entry.stations[staIdx];
+    if ( std::isnan(value.distance) )
+    {
+        sh.misses++;
+        sh.entries++;
+        const Location& staLoc = sh.stationLocations[staIdx];
+        value.distance = computeDistance(event.latitude, event.longitude, event.depth,
+                                         staLoc.lat, staLoc.lon, staLoc.depth,
+                                         &value.azimuth);
+    }
+    else
+    {
+        sh.hits++;
+    }
+
+    if ( azimuth ) *azimuth = value.azimuth;
+    return value.distance;
+}
+
+
+double
+DistanceCache::compute(const Event& event1, const Event& event2, double *azimuth)
+{
+    Shard& sh = shard(event1.id);
+    std::lock_guard<std::mutex> lock(sh.mutex);
+    makeRoom(sh);
+
+    EventEntry& entry = eventEntry(sh, event1);
+    const Location location( {event2.latitude, event2.longitude, event2.depth} );
+
+    auto it = entry.events.find(event2.id);
+    if ( it == entry.events.end() )
+    {
+        it = entry.events.emplace(event2.id, EventValue()).first;
+        sh.entries++;
+    }
+    else if ( it->second.location == location )
+    {
+        sh.hits++;
+        if ( azimuth ) *azimuth = it->second.value.azimuth;
+        return it->second.value.distance;
+    }
+
+    sh.misses++;
+    EventValue& evValue = it->second;
+    evValue.location = location;
+    evValue.value.distance = computeDistance(event1.latitude, event1.longitude, event1.depth,
+                                             event2.latitude, event2.longitude, event2.depth,
+                                             &evValue.value.azimuth);
+    if ( azimuth ) *azimuth = evValue.value.azimuth;
+    return evValue.value.distance;
+}
+
+
+}
+}
@@ -0,0 +1,125 @@
+/***************************************************************************
+ *   Copyright (C) by ETHZ/SED                                             *
+ *                                                                         *
+ * This program is free software: you can redistribute it and/or modify    *
+ * it under the terms of the GNU Affero General Public License as published*
+ * by the Free Software Foundation, either version 3 of the License, or    *
+ * (at your option) any later version.                                     *
+ *                                                                         *
+ * This program is distributed in the hope that it will be useful,         *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of          *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           *
+ * GNU Affero General Public License for more details.                     *
+ *                                                                         *
+ *                                                                         *
+ *   Developed by Luca Scarabello <luca.scarabello@sed.ethz.ch>            *
+ ***************************************************************************/ 
+
+#ifndef __RTDD_APPLICATIONS_DISTCACHE_H__
+#define __RTDD_APPLICATIONS_DISTCACHE_H__
+
+#include "catalog.h"
+#include <seiscomp3/core/baseobject.h>
+#include <unordered_map>
+#include <mutex>
+#include <array>
+#include <vector>
+
+
+namespace Seiscomp {
+namespace HDD {
+
+/*
+ * Memoize the event to station and inter-event distances (and azimuths), that
+ * are otherwise computed again and again for the same pairs by the neighbouring
+ * events selection, the missing phases detection and the cross-correlation
+ * (e.g. for the background catalog events in real-time relocations)
+ *
+ * The entries are grouped by event id and remember the locations they were
+ * computed for: when an event location changes all the entries of that event
+ * are discarded and computed again, the same happens when events of different
+ * catalogs share the same id. invalidate() discards them explicitly.
+ *
+ * The returned values are the same computeDistance would return.
+ *
+ * The cache is safe for concurrent use. The events are spread over several
+ * independently locked shards, so that concurrent callers rarely wait for
+ * each other.
+ */
+class DistanceCache : public Core::BaseObject {
+
+    public:
+        DistanceCache(unsigned maxEntries = 10000000);
+
+        double compute(const Catalog::Event& event, const Catalog::Station& station,
+                       double *azimuth = nullptr);
+
+        double compute(const Catalog::Event& event1, const Catalog::Event& event2,
+                       double *azimuth = nullptr);
+
+        void invalidate(unsigned eventId);
+
+        void clear();
+
+        struct Stats {
+            unsigned long entries;
+            unsigned long hits;
+            unsigned long misses;
+        };
+        Stats stats() const;
+
+    private:
+        struct Location {
+            double lat, lon, depth; // depth in km (negative elevation for stations)
+            bool operator==(const Location& other) const
+            {
+                return lat == other.lat && lon == other.lon && depth == other.depth;
+            }
+        };
+
+        struct Value {
+            double distance; // NaN when not computed yet
+            double azimuth;
+        };
+
+        struct EventValue {
+            Location location; // of the other event
+            Value value;
+        };
+
+        struct EventEntry {
+            Location location;
+            std::vector<Value> stations;                   // indexed by station index
+            std::unordered_map<unsigned, EventValue> events; // indexed by event id
+        };
+
+        // the stations are stored by index, to keep the event entries compact
+        struct Shard {
+            mutable std::mutex mutex;
+            std::unordered_map<unsigned, EventEntry> events;  // indexed by event id
+            std::unordered_map<std::string, unsigned> stationIdx; // indexed by station id
+            std::vector<Location> stationLocations;           // indexed by station index
+            unsigned long entries = 0;
+            unsigned long hits = 0;
+            unsigned long misses = 0;
+        };
+
+        Shard& shard(unsigned eventId) { return _shards[eventId % NumShards]; }
+
+        EventEntry& eventEntry(Shard& shard, const Catalog::Event& event);
+
+        unsigned stationIndex(Shard& shard, const Catalog::Station& station);
+
+        void makeRoom(Shard& shard);
+
+        static constexpr unsigned NumShards = 64;
+        const unsigned long _maxShardEntries;
+        std::array<Shard, NumShards> _shards;
+};
+
+DEFINE_SMARTPOINTER(DistanceCache);
+
+}
+}
+
+#endif
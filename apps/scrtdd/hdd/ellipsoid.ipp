@@ -21,7 +21,7 @@
 #include "utils.h"
 #include <seiscomp3/math/geo.h>
 #include <seiscomp3/math/math.h>
-#include <set>
+#include <stdexcept>
 
 namespace Seiscomp {
 namespace HDD {
@@ -36,20 +36,33 @@ struct Ellipsoid
 {
     bool isInside(double lat, double lon, double depth) const
     {
-        double distance, az;
-        distance = computeDistance(lat, lon, 0, this->lat, this->lon, 0, &az);
-        az = deg2rad(az);
-
-        double dist_x = distance * std::sin(az);
-        double dist_y = distance * std::cos(az);
-        double dist_z = depth - this->depth;
+        double dist_x, dist_y, dist_z;
+        localOffsets(lat, lon, depth, dist_x, dist_y, dist_z);
+        return isInsideOffsets(dist_x, dist_y, dist_z);
+    }
 
+    // same as isInside but for the offsets computed by localOffsets
+    bool isInsideOffsets(double dist_x, double dist_y, double dist_z) const
+    {
         double one = std::pow( dist_x / axis_a, 2) +
                      std::pow( dist_y / axis_b, 2) +
                      std::pow( dist_z / axis_c, 2);
         return one <= 1;
     }
 
+    // offsets (km) of a point from the ellipsoid origin: east, north and depth
+    void localOffsets(double lat, double lon, double depth,
+                      double& dist_x, double& dist_y, double& dist_z) const
+    {
+        double distance, az;
+        distance = computeDistance(lat, lon, 0, this->lat, this->lon, 0, &az);
+        az = deg2rad(az);
+
+        dist_x = distance * std::sin(az);
+        dist_y = distance * std::cos(az);
+        dist_z = depth - this->depth;
+    }
+
     double axis_a=0, axis_b=0, axis_c=0; // axis in km
     double lat=0, lon=0, depth=0;        // origin
 };
@@ -112,22 +125,44 @@ public:
         return _outerEllipsoid.isInside(lat, lon, depth) && ! _innerEllipsoid.isInside(lat, lon, depth);
     }
 
+    // same as isInside but for the offsets computed by Ellipsoid::localOffsets
+    // (inner and outer ellipsoids share the same origin)
+    bool isInsideOffsets(double dist_x, double dist_y, double dist_z) const
+    {
+        return _outerEllipsoid.isInsideOffsets(dist_x, dist_y, dist_z) &&
+               ! _innerEllipsoid.isInsideOffsets(dist_x, dist_y, dist_z);
+    }
+
     static bool
     isInQuadrant(const Ellipsoid& ellip, double lat, double lon, double depth, int quadrant /* 1-8 */)
     {
         if (quadrant < 1 || quadrant > 8)
             throw std::invalid_argument( "quadrant should be between 1 and 8");
 
-        if (depth < ellip.depth && std::set<int>{1,2,3,4}.count(quadrant) != 0) return false;
-        if (depth > ellip.depth && std::set<int>{5,6,7,8}.count(quadrant) != 0) return false;
+        return ( quadrantMask(ellip, lat, lon, depth) & (1u << (quadrant-1)) ) != 0;
+    }
+
+    /*
+     * Return the quadrants a point belongs to as a bitmask: bit (quadrant-1) is
+     * set for each quadrant. A point lying on a quadrant boundary belongs
+     * to all the quadrants sharing that boundary
+     */
+    static unsigned
+    quadrantMask(const Ellipsoid& ellip, double lat, double lon, double depth)
+    {
+        //                                   quadrants: 87654321
+        unsigned mask = 0xFF;
+
+        if (depth < ellip.depth) mask &= ~0x0Fu; // not in 1,2,3,4
+        if (depth > ellip.depth) mask &= ~0xF0u; // not in 5,6,7,8
 
-        if (lon < ellip.lon && std::set<int>{1,4,5,8}.count(quadrant) != 0) return false;
-        if (lon > ellip.lon && std::set<int>{2,3,6,7}.count(quadrant) != 0) return false;
+        if (lon < ellip.lon) mask &= ~0x99u;     // not in 1,4,5,8
+        if (lon > ellip.lon) mask &= ~0x66u;     // not in 2,3,6,7
 
-        if (lat < ellip.lat && std::set<int>{1,2,5,6}.count(quadrant) != 0) return false;
-        if (lat > ellip.lat && std::set<int>{3,4,7,8}.count(quadrant) != 0) return false;
+        if (lat < ellip.lat) mask &= ~0x33u;     // not in 1,2,5,6
+        if (lat > ellip.lat) mask &= ~0xCCu;     // not in 3,4,7,8
 
-        return true;
+        return mask;
     }
 
 private:
@@ -17,6 +17,7 @@
 
 #include "hypodd.h"
 #include "utils.h"
+#include "ellipsoid.ipp"
 
 #include <seiscomp3/core/datetime.h>
 #include <seiscomp3/core/strings.h>
@@ -94,8 +95,27 @@ HypoDD::HypoDD(const CatalogCPtr& catalog, const Config& cfg, const string& work
     setWaveformCacheAll(false);
     setWaveformDebug(false);
 
-    _ttt = TravelTimeTableInterface::Create(_cfg.ttt.type.c_str());
-    _ttt->setModel(_cfg.ttt.model.c_str());
+    _ttt = new TravelTimeCache(_cfg.ttt.type, _cfg.ttt.model, _cfg.ttt.cacheGridSpacing);
+    _distCache = new DistanceCache();
+
+    if ( ! _cfg.ttt.gridFile.empty() )
+    {
+        if ( Util::fileExists(_cfg.ttt.gridFile) )
+        {
+            // an invalid or outdated grid must not prevent generateTravelTimeGrid
+            // from replacing it
+            try {
+                _ttt->setGrid( new TravelTimeGrid(_cfg.ttt.gridFile) );
+            } catch ( exception& e ) {
+                SEISCOMP_WARNING("Cannot load travel time grid file %s (%s): the travel "
+                                 "time table will be used instead",
+                                 _cfg.ttt.gridFile.c_str(), e.what());
+            }
+        }
+        else
+            SEISCOMP_WARNING("Travel time grid file %s not found: the travel time table "
+                             "will be used instead", _cfg.ttt.gridFile.c_str());
+    }
 }
 
 
@@ -126,6 +146,8 @@ void HypoDD::setCatalog(const CatalogCPtr& catalog)
     _srcCat = catalog;
     _ddbgc = Catalog::filterPhasesAndSetWeights(_srcCat, Phase::Source::CATALOG,
                                                 _cfg.validPphases, _cfg.validSphases);
+    _ddbgcIndex = new EventSpatialIndex(*_ddbgc);
+    _neighboursCache.clear();
 }
 
 
@@ -234,7 +256,7 @@ CatalogPtr HypoDD::relocateCatalog()
         _cfg.ddObservations2.minEStoIEratio, _cfg.ddObservations2.minDTperEvt,
         _cfg.ddObservations2.maxDTperEvt, _cfg.ddObservations2.minNumNeigh,
         _cfg.ddObservations2.maxNumNeigh, _cfg.ddObservations2.numEllipsoids,
-        _cfg.ddObservations2.maxEllipsoidSize, true
+        _cfg.ddObservations2.maxEllipsoidSize, true, _cfg.numThreads, _distCache
     );
 
     // write catalog for debugging purpose
@@ -293,6 +315,10 @@ CatalogPtr HypoDD::relocateSingleEvent(const CatalogCPtr& singleEvent)
         boost::filesystem::remove_all(subFolder);
     }
 
+    // the neighbours candidates found by step 1 are reused by step 2, which
+    // starts from a close location
+    CandidateScan candidateScan;
+
     //
     // Step 1: refine location without cross correlation
     //
@@ -311,7 +337,7 @@ CatalogPtr HypoDD::relocateSingleEvent(const CatalogCPtr& singleEvent)
             _cfg.ddObservations1.minEStoIEratio, _cfg.ddObservations1.minDTperEvt, 
             _cfg.ddObservations1.maxDTperEvt, _cfg.ddObservations1.minNumNeigh,
             _cfg.ddObservations1.maxNumNeigh, _cfg.ddObservations1.numEllipsoids,
-            _cfg.ddObservations1.maxEllipsoidSize
+            _cfg.ddObservations1.maxEllipsoidSize, candidateScan
     );
 
     if ( relocatedEvCat )
@@ -339,7 +365,8 @@ CatalogPtr HypoDD::relocateSingleEvent(const CatalogCPtr& singleEvent)
             _cfg.ddObservations2.maxESdist, _cfg.ddObservations2.minEStoIEratio,
             _cfg.ddObservations2.minDTperEvt, _cfg.ddObservations2.maxDTperEvt,
             _cfg.ddObservations2.minNumNeigh, _cfg.ddObservations2.maxNumNeigh,
-            _cfg.ddObservations2.numEllipsoids, _cfg.ddObservations2.maxEllipsoidSize
+            _cfg.ddObservations2.numEllipsoids, _cfg.ddObservations2.maxEllipsoidSize,
+            candidateScan
     );
 
     if ( relocatedEvWithXcorr )
@@ -376,7 +403,8 @@ HypoDD::relocateEventSingleStep(const CatalogCPtr& evToRelocateCat,
                                 int minNumNeigh,
                                 int maxNumNeigh,
                                 int numEllipsoids,
-                                double maxEllipsoidSize)
+                                double maxEllipsoidSize,
+                                CandidateScan& candidateScan)
 {
     if ( !Util::createPath(workingDir) )
     {
@@ -396,10 +424,10 @@ HypoDD::relocateEventSingleStep(const CatalogCPtr& evToRelocateCat,
         //
         bool keepUnmatchedPhases = doXcorr; //useful for detecting missed picks
 
-        NeighboursPtr neighbours = selectNeighbouringEvents(
-            _ddbgc, evToRelocate, evToRelocateCat, minPhaseWeight, minESdist,  maxESdist,
+        NeighboursPtr neighbours = selectNeighbouringEventsCached(
+            evToRelocate, evToRelocateCat, minPhaseWeight, minESdist,  maxESdist,
             minEStoIEratio, minDTperEvt,  maxDTperEvt, minNumNeigh, maxNumNeigh,
-            numEllipsoids, maxEllipsoidSize, keepUnmatchedPhases
+            numEllipsoids, maxEllipsoidSize, keepUnmatchedPhases, candidateScan
         );
 
         //
@@ -446,6 +474,139 @@ HypoDD::relocateEventSingleStep(const CatalogCPtr& evToRelocateCat,
 }
 
 
+/*
+ * Same as selectNeighbouringEvents on the background catalog, but reuse the
+ * neighbours previously selected for the same event location and phases.
+ * Origins are often relocated again without changes (e.g. cron delayTimes)
+ * or with only small location changes (origin updates).
+ * When a new selection is needed, it reuses the candidate events of
+ * candidateScan (e.g. found by step 1 for step 2) if they cover its area
+ */
+NeighboursPtr
+HypoDD::selectNeighbouringEventsCached(const Event& refEv,
+                                       const CatalogCPtr& refEvCatalog,
+                                       double minPhaseWeight,
+                                       double minESdist,
+                                       double maxESdist,
+                                       double minEStoIEratio,
+                                       int minDTperEvt,
+                                       int maxDTperEvt,
+                                       int minNumNeigh,
+                                       int maxNumNeigh,
+                                       int numEllipsoids,
+                                       double maxEllipsoidSize,
+                                       bool keepUnmatched,
+                                       CandidateScan& candidateScan)
+{
+    auto select = [&]() {
+        return selectNeighbouringEvents(
+            _ddbgc, refEv, refEvCatalog, minPhaseWeight, minESdist, maxESdist,
+            minEStoIEratio, minDTperEvt, maxDTperEvt, minNumNeigh, maxNumNeigh,
+            numEllipsoids, maxEllipsoidSize, keepUnmatched, _ddbgcIndex, _distCache,
+            &candidateScan);
+    };
+
+    if ( _cfg.neighboursCache.maxEntries == 0 )
+        return select();
+
+    // the selection depends on the reference event phases only through
+    // the stations and types of the phases passing the weight threshold
+    vector<pair<string,Phase::Type>> refEvPhases;
+    auto eqlrng = refEvCatalog->getPhases().equal_range(refEv.id);
+    for (auto it = eqlrng.first; it != eqlrng.second; ++it)
+    {
+        const Phase& phase = it->second;
+        if ( phase.procInfo.weight >= minPhaseWeight )
+            refEvPhases.emplace_back(phase.stationId, phase.procInfo.type);
+    }
+    std::sort(refEvPhases.begin(), refEvPhases.end());
+
+    const vector<double> params = {
+        minPhaseWeight, minESdist, maxESdist, minEStoIEratio, double(minDTperEvt),
+        double(maxDTperEvt), double(minNumNeigh), double(maxNumNeigh),
+        double(numEllipsoids), maxEllipsoidSize, double(keepUnmatched)
+    };
+
+    // look for the same origin, otherwise for the closest one within tolerance
+    auto found = _neighboursCache.end();
+    double shift = 0;
+    for (auto entry = _neighboursCache.begin(); entry != _neighboursCache.end(); ++entry)
+    {
+        if ( entry->params != params || entry->refEvPhases != refEvPhases )
+            continue;
+
+        if ( entry->refEv == refEv )
+        {
+            found = entry;
+            shift = 0;
+            break;
+        }
+
+        double entryShift = computeDistance(entry->refEv, refEv);
+        if ( entryShift <= _cfg.neighboursCache.locationTolerance &&
+             ( found == _neighboursCache.end() || entryShift < shift ) )
+        {
+            found = entry;
+            shift = entryShift;
+        }
+    }
+
+    if ( found != _neighboursCache.end() )
+    {
+        // most recently used first
+        _neighboursCache.splice(_neighboursCache.begin(), _neighboursCache, found);
+        const NeighboursCacheEntry& entry = _neighboursCache.front();
+
+        if ( entry.refEv == refEv )
+        {
+            SEISCOMP_INFO("Reusing the neighbouring events previously selected for this origin");
+            NeighboursPtr neighbours = new Neighbours(*entry.neighbours);
+            neighbours->refEvId = refEv.id;
+            return neighbours;
+        }
+
+        //
+        // The origin moved a little: keep the neighbours still within the
+        // outmost ellipsoid, unless too few are left
+        //
+        HddEllipsoid ellipsoid(maxEllipsoidSize * 2, refEv.latitude, refEv.longitude, refEv.depth);
+        NeighboursPtr neighbours = new Neighbours(*entry.neighbours);
+        neighbours->refEvId = refEv.id;
+        for ( unsigned neighEvId : entry.neighbours->ids() )
+        {
+            const Event& event = _ddbgc->getEvents().at(neighEvId);
+            if ( ! ellipsoid.getOuterEllipsoid().isInside(event.latitude, event.longitude, event.depth) )
+            {
+                neighbours->remove(neighEvId);
+                neighbours->numNeighbours--;
+            }
+        }
+
+        if ( neighbours->numNeighbours >= unsigned(std::max(minNumNeigh, 0)) )
+        {
+            SEISCOMP_INFO("Reusing the neighbouring events selected for a previous origin "
+                          "location (%.3f km away): %u neighbours kept",
+                          shift, neighbours->numNeighbours);
+            return neighbours;
+        }
+    }
+
+    NeighboursPtr neighbours = select();
+
+    NeighboursCacheEntry entry;
+    entry.refEv = refEv;
+    entry.refEvPhases = std::move(refEvPhases);
+    entry.params = params;
+    entry.neighbours = new Neighbours(*neighbours);
+    _neighboursCache.push_front( std::move(entry) );
+    if ( _neighboursCache.size() > _cfg.neighboursCache.maxEntries )
+        _neighboursCache.pop_back();
+
+    return neighbours;
+}
+
+
+
 CatalogPtr
 HypoDD::relocate(CatalogPtr& catalog,
                  const std::list<NeighboursPtr>& neighbourCats,
@@ -453,19 +614,28 @@ HypoDD::relocate(CatalogPtr& catalog,
                  const XCorrCache& xcorr) const
 {
     // Create a solver and then add observations
-    Solver solver(_cfg.solver.type);
+    Solver solver(_cfg.solver.type, _cfg.numThreads);
+    solver.setValidatePartialDerivatives(_cfg.solver.validatePartialDerivatives);
     ObservationParams obsparams;
+    bool rebuildSystem = true;
+    double prevResidualRMS = -1;
 
     for ( unsigned iteration=0; iteration < _cfg.solver.algoIterations; iteration++ )
     {
-        solver.reset();
-
         //
-        // Add absolute travel time/xcorr differences to the solver (the observations)
+        // Add absolute travel time/xcorr differences to the solver (the observations).
+        // This is required only the first time, after that the solver is incrementally
+        // updated with the events that moved (see updateObservations)
         //
-        for (const NeighboursPtr& neighbours : neighbourCats)
+        if ( rebuildSystem )
         {
-            addObservations(solver, catalog, neighbours, keepNeighboursFixed, xcorr, obsparams);
+            solver.reset();
+            obsparams = ObservationParams();
+
+            for (const NeighboursPtr& neighbours : neighbourCats)
+            {
+                addObservations(solver, catalog, neighbours, keepNeighboursFixed, xcorr, obsparams);
+            }
         }
         obsparams.addToSolver(solver);
 
@@ -502,19 +672,84 @@ HypoDD::relocate(CatalogPtr& catalog,
             solver.solve(_cfg.solver.solverIterations, dampingFactor,
                          downWeightingByResidual, meanLonShiftConstraint,
                          meanLatShiftConstraint,  meanDepthShiftConstraint,
-                         meanTTShiftConstraint, _cfg.solver.L2normalization);
+                         meanTTShiftConstraint, _cfg.solver.L2normalization,
+                         _cfg.solver.blockJacobiPreconditioning);
         } catch ( exception &e ) {
             SEISCOMP_INFO("Cannot solve the double-difference system, stop here (%s)", e.what());
             break;
         }
 
-        // prepare for next iteration
-        obsparams = ObservationParams();
-
         // update event parameters
+        CatalogPtr prevCatalog = catalog;
         catalog = updateRelocatedEvents(solver, catalog, neighbourCats, obsparams);
+
+        // prepare for next iteration
+        rebuildSystem = ! updateObservations(solver, prevCatalog, catalog, neighbourCats, obsparams);
+
+        //
+        // check convergence: how much the events moved in this iteration and
+        // how much the residuals and their weights changed since the previous one
+        //
+        double maxShift = 0, sumSquaredShifts = 0;
+        unsigned numRelocated = 0;
+        for (const NeighboursPtr& neighbours : neighbourCats)
+        {
+            const Event& event = catalog->getEvents().at(neighbours->refEvId);
+            if ( ! event.relocInfo.isRelocated ) continue;
+            const Event& prevEvent = prevCatalog->getEvents().at(neighbours->refEvId);
+            double shift = computeDistance(prevEvent, event);
+            maxShift = std::max(maxShift, shift);
+            sumSquaredShifts += shift * shift;
+            numRelocated++;
+        }
+        double rmsShift = numRelocated ? std::sqrt(sumSquaredShifts / numRelocated) : 0;
+        double residualRMS = solver.getWeightedResidualRMS();
+        double residualRMSChange = prevResidualRMS > 0 ?
+                     std::abs(residualRMS - prevResidualRMS) / prevResidualRMS : 1.;
+        double changedWeightsFraction = solver.getChangedWeightsFraction();
+        prevResidualRMS = residualRMS;
+
+        SEISCOMP_INFO("Iteration %u: events shift max %.4f rms %.4f [km] weighted "
+                      "residuals rms %.4f (change %.4f) changed weights %.4f",
+                      iteration, maxShift, rmsShift, residualRMS, residualRMSChange,
+                      changedWeightsFraction);
+
+        const auto& conv = _cfg.solver.convergence;
+        if ( ! conv.enable ||
+             maxShift > conv.maxShift || rmsShift > conv.rmsShift ||
+             residualRMSChange > conv.residualRMSChange ||
+             changedWeightsFraction > conv.changedWeightsFraction )
+        {
+            continue;
+        }
+
+        // The parameters schedule must reach its final values before stopping,
+        // so jump to the last iteration unless the schedule is constant
+        bool constantSchedule =
+            _cfg.solver.dampingFactorStart == _cfg.solver.dampingFactorEnd &&
+            _cfg.solver.downWeightingByResidualStart == _cfg.solver.downWeightingByResidualEnd &&
+            _cfg.solver.meanShiftConstraintStart == _cfg.solver.meanShiftConstraintEnd;
+        if ( constantSchedule )
+        {
+            SEISCOMP_INFO("Solutions converged at iteration %u, stop here", iteration);
+            break;
+        }
+        if ( iteration + 2 < _cfg.solver.algoIterations )
+        {
+            SEISCOMP_INFO("Solutions converged at iteration %u, jump to the final iteration",
+                          iteration);
+            iteration = _cfg.solver.algoIterations - 2;
+        }
     }
 
+    TravelTimeCache::Stats tttStats = _ttt->stats();
+    SEISCOMP_DEBUG("Travel time cache: %lu entries %lu hits %lu misses",
+                   tttStats.entries, tttStats.hits, tttStats.misses);
+
+    DistanceCache::Stats distStats = _distCache->stats();
+    SEISCOMP_DEBUG("Distance cache: %lu entries %lu hits %lu misses",
+                   distStats.entries, distStats.hits, distStats.misses);
+
     // build the relocated catalog from the results of relocations
     CatalogPtr relocatedCatalog( new Catalog() );
     for (const NeighboursPtr& neighbours : neighbourCats)
@@ -576,7 +811,7 @@ HypoDD::addObservations(Solver& solver, const CatalogCPtr& catalog, const Neighb
         //
         // loop through neighbouring events and look for the matching phase
         // 
-        for ( unsigned neighEvId : neighbours->ids )
+        for ( unsigned neighEvId : neighbours->ids() )
         {
             const Event& event = catalog->getEvents().at(neighEvId);
 
@@ -645,34 +880,97 @@ HypoDD::addObservations(Solver& solver, const CatalogCPtr& catalog, const Neighb
     }
 }
 
+/*
+ * Update the observations already in the solver after an iteration of
+ * relocation, instead of building the double-difference system from scratch:
+ * the neighbours don't change between iterations, only the events location and
+ * origin time do. Returns false if the system needs to be rebuilt
+ */
+bool
+HypoDD::updateObservations(Solver& solver,
+                           const CatalogCPtr& prevCatalog,
+                           const CatalogCPtr& catalog,
+                           const std::list<NeighboursPtr>& neighbourCats,
+                           ObservationParams& obsparams ) const
+{
+    try {
+        obsparams.update(_ttt, catalog);
+    } catch ( exception &e ) {
+        SEISCOMP_DEBUG("Cannot update travel times, the system will be rebuilt (%s)", e.what());
+        return false;
+    }
+
+    // only the reference events are updated in the catalog
+    for (const NeighboursPtr& neighbours : neighbourCats)
+    {
+        const Event& prevEvent = prevCatalog->getEvents().at(neighbours->refEvId);
+        const Event& event = catalog->getEvents().at(neighbours->refEvId);
+        if ( event.time != prevEvent.time )
+        {
+            solver.shiftEventOriginTime(event.id, (event.time - prevEvent.time).length());
+        }
+    }
+    return true;
+}
+
+
 void
-HypoDD::ObservationParams::add(TravelTimeTableInterfacePtr ttt, const Event& event,
+HypoDD::ObservationParams::add(TravelTimeCachePtr ttt, const Event& event,
                                const Station& station, char phaseType )
 {
-    const std::string key = std::to_string(event.id) + "@" + station.id + ":" + phaseType;
-    if ( _entries.find(key) == _entries.end() )
+    const Key key( {event.id, station.id, phaseType} );
+    auto it = _entries.find(key);
+    if ( it == _entries.end() ||
+         it->second.event.latitude  != event.latitude  ||
+         it->second.event.longitude != event.longitude ||
+         it->second.event.depth     != event.depth )
+    {
+        double travelTime = ttt->compute(event, station, phaseType);
+        _entries[key] = Entry( {event, station, phaseType, travelTime, true} );
+    }
+}
+
+
+/*
+ * Recompute the travel times of the entries whose event moved in the catalog
+ */
+void
+HypoDD::ObservationParams::update(TravelTimeCachePtr ttt, const CatalogCPtr& catalog)
+{
+    for ( auto& kv : _entries )
     {
-        TravelTime tt = ttt->compute(string(1, phaseType).c_str(),
-                                     event.latitude, event.longitude, event.depth, 
-                                     station.latitude, station.longitude, station.elevation);
-        _entries[key] = Entry( {event, station, phaseType, tt.time} );
+        Entry& e = kv.second;
+        const Event& event = catalog->getEvents().at(e.event.id);
+        if ( e.event.latitude  != event.latitude  ||
+             e.event.longitude != event.longitude ||
+             e.event.depth     != event.depth )
+        {
+            e.event = event;
+            e.travelTime = ttt->compute(event, e.station, e.phaseType);
+            e.changed = true;
+        }
     }
 }
 
 const HypoDD::ObservationParams::Entry&
 HypoDD::ObservationParams::get(unsigned eventId, const std::string stationId, char phaseType ) const
 {
-    const std::string key = std::to_string(eventId) + "@" + stationId + ":" + phaseType;
-    return _entries.at(key);
+    return _entries.at( Key( {eventId, stationId, phaseType} ) );
 }
 
 
+/*
+ * Add to the solver the entries that are new or have changed since the last call
+ */
 void
-HypoDD::ObservationParams::addToSolver(Solver& solver) const
+HypoDD::ObservationParams::addToSolver(Solver& solver)
 {
-    for ( const auto& kv : _entries )
+    for ( auto& kv : _entries )
     {
-        const ObservationParams::Entry& e = kv.second;
+        ObservationParams::Entry& e = kv.second;
+        if ( ! e.changed )
+            continue;
+        e.changed = false;
         solver.addObservationParams(e.event.id, e.station.id, e.phaseType,
                                     e.event.latitude, e.event.longitude, e.event.depth,
                                     e.station.latitude, e.station.longitude, e.station.elevation,
@@ -687,25 +985,27 @@ HypoDD::updateRelocatedEvents(const Solver& solver,
                               const std::list<NeighboursPtr>& neighbourCats,
                               ObservationParams& obsparams ) const
 {
-    unordered_map<string,Station> stations = catalog->getStations();
-    map<unsigned,Event> events = catalog->getEvents();
-    unordered_multimap<unsigned,Phase> phases = catalog->getPhases();
+    // the new catalog shares the data with the current one until updated
+    // (stations are never updated)
+    CatalogPtr relocatedCatalog( new Catalog(*catalog) );
     unsigned relocatedEvs = 0;
 
     for (const NeighboursPtr& neighbours : neighbourCats)
     {
-        Event& event = events.at(neighbours->refEvId);
+        Event event = catalog->getEvents().at(neighbours->refEvId);
         event.relocInfo.isRelocated = false;
 
         double deltaLat, deltaLon, deltaDepth, deltaTT;
         if ( ! solver.getEventChanges(event.id, deltaLat, deltaLon, deltaDepth, deltaTT) )
         {
+            relocatedCatalog->updateEvent(event);
             continue;
         }
 
         if ( event.depth + deltaDepth < 0 )
         {
             SEISCOMP_DEBUG("Ignoring airquake event %s", string(event).c_str());
+            relocatedCatalog->updateEvent(event);
             continue;
         }
 
@@ -730,11 +1030,13 @@ HypoDD::updateRelocatedEvents(const Solver& solver,
 
         unsigned rmsCount = 0;
         unsigned pCount = 0;
-        auto eqlrng = phases.equal_range(event.id);
+        vector<Phase> phases;
+        auto eqlrng = catalog->getPhases().equal_range(event.id);
         for (auto it = eqlrng.first; it != eqlrng.second; ++it) 
         {
-            Phase& phase = it->second;
-            const Station& station = stations.at(phase.stationId);
+            phases.push_back(it->second);
+            Phase& phase = phases.back();
+            const Station& station = catalog->getStations().at(phase.stationId);
             char phaseTypeAsChar = static_cast<char>(phase.procInfo.type);
 
             phase.relocInfo.isRelocated = false;
@@ -793,11 +1095,14 @@ HypoDD::updateRelocatedEvents(const Solver& solver,
             event.relocInfo.meanObsWeight      /= pCount;
             event.relocInfo.meanFinalObsWeight /= pCount;
         }
+
+        relocatedCatalog->updateEvent(event);
+        relocatedCatalog->replacePhases(event.id, phases);
     }
 
     SEISCOMP_INFO("Successfully relocated %u events", relocatedEvs);
 
-    return new Catalog(stations, events, phases);
+    return relocatedCatalog;
 }
 
 
@@ -856,7 +1161,7 @@ HypoDD::findMissingEventPhases(const Event& refEv, CatalogPtr& refEvCatalog,
             const Event& event = peer.first;
             const Phase& phase = peer.second;
             double travelTime = (phase.time - event.time).length();
-            double stationDistance = computeDistance(event, station);
+            double stationDistance = _distCache->compute(event, station);
             double vel = stationDistance / travelTime;
             phaseVelocity += vel;
         }
@@ -924,7 +1229,7 @@ HypoDD::findPhasePeers(const Station& station, const Phase::Type& phaseType,
     //
     vector<PhasePeer> phasePeers;
 
-    for ( unsigned neighEvId : neighbours->ids )
+    for ( unsigned neighEvId : neighbours->ids() )
     {
         const Event& event = searchCatalog->getEvents().at(neighEvId);
 
@@ -988,7 +1293,7 @@ HypoDD::createThoreticalPhase(const Station& station,
     refEvNewPhase.procInfo.type = phaseType;
 
     // use phase velocity to compute phase time
-    double stationDistance = computeDistance(refEv, station);
+    double stationDistance = _distCache->compute(refEv, station);
     refEvNewPhase.time = refEv.time + Core::TimeSpan(stationDistance / phaseVelocity);
 
     refEvNewPhase.lowerUncertainty = Catalog::DEFAULT_AUTOMATIC_PICK_UNCERTAINTY;
@@ -1076,7 +1381,7 @@ HypoDD::buildXcorrDiffTTimePairs(CatalogPtr& catalog,
         //
         // skip stations too far away
         //
-        double stationDistance = computeDistance(refEv, station);
+        double stationDistance = _distCache->compute(refEv, station);
         if ( stationDistance > _cfg.ddObservations2.xcorrMaxEvStaDist &&
              _cfg.ddObservations2.xcorrMaxEvStaDist >= 0 )
             continue;
@@ -1084,14 +1389,14 @@ HypoDD::buildXcorrDiffTTimePairs(CatalogPtr& catalog,
         //
         // loop through neighbouring events and cross correlate phase pairs
         //
-        for ( unsigned neighEvId : neighbours->ids )
+        for ( unsigned neighEvId : neighbours->ids() )
         {
             const Event& event = catalog->getEvents().at(neighEvId);
 
             //
             // skip events too far away
             //
-            double interEventDistance = computeDistance(refEv, event);
+            double interEventDistance = _distCache->compute(refEv, event);
             if ( interEventDistance > _cfg.ddObservations2.xcorrMaxInterEvDist &&
                  _cfg.ddObservations2.xcorrMaxInterEvDist >= 0 )
                 continue;
@@ -1746,6 +2051,19 @@ namespace {
 }
 
 
+void
+HypoDD::generateTravelTimeGrid() const
+{
+    if ( _cfg.ttt.gridFile.empty() )
+    {
+        throw runtime_error("No travel time grid file configured");
+    }
+    TravelTimeGrid::generate(_cfg.ttt.gridFile, _cfg.ttt.type, _cfg.ttt.model,
+                             _srcCat, _cfg.ttt.gridSpacing, _cfg.ttt.gridMargin);
+    SEISCOMP_INFO("Wrote travel time grid %s", _cfg.ttt.gridFile.c_str());
+}
+
+
 void
 HypoDD::evalXCorr()
 {
@@ -1812,7 +2130,7 @@ HypoDD::evalXCorr()
                 _cfg.ddObservations2.minEStoIEratio, _cfg.ddObservations2.minDTperEvt,
                 _cfg.ddObservations2.maxDTperEvt, _cfg.ddObservations2.minNumNeigh,
                 _cfg.ddObservations2.maxNumNeigh, _cfg.ddObservations2.numEllipsoids,
-                _cfg.ddObservations2.maxEllipsoidSize, false);
+                _cfg.ddObservations2.maxEllipsoidSize, false, _ddbgcIndex, _distCache);
         } catch ( ... ) { continue; }
 
         CatalogPtr catalog;
@@ -1847,10 +2165,10 @@ HypoDD::evalXCorr()
         XCorrEvalStats evStats;
         map<unsigned,XCorrEvalStats> statsByNeighbour; // key neighbour id
 
-        for ( const auto& kv : neighbours->allPhases() )
-            for ( Phase::Type phaseType : kv.second )
+        for ( const auto& staPhase : neighbours->allPhases() )
         {
-            const string stationId = kv.first;
+            const string& stationId = staPhase.first;
+            const Phase::Type phaseType = staPhase.second;
             const Phase& catalogPhase = _ddbgc->searchPhase(event.id, stationId, phaseType)->second;
 
             XCorrEvalStats phStaStats;
@@ -1873,13 +2191,13 @@ HypoDD::evalXCorr()
             statsByStation[catalogPhase.stationId] += phStaStats;
 
             const Station& station = _ddbgc->getStations().at(catalogPhase.stationId);
-            double stationDistance = computeDistance(event, station);
+            double stationDistance = _distCache->compute(event, station);
             statsByStaDistance[ int(stationDistance/STA_DIST_STEP) ] += phStaStats;
 
             //
             //  collect stats by neighbour
             //
-            for ( unsigned neighEvId : neighbours->ids )
+            for ( unsigned neighEvId : neighbours->ids() )
             {
                 if ( neighbours->has(neighEvId, stationId, phaseType) )
                 {
@@ -1908,7 +2226,7 @@ HypoDD::evalXCorr()
             const Event& neighbEv = catalog->getEvents().at(kv.first);
             XCorrEvalStats& neighStats = kv.second;
             neighStats.meanCount *= neighStats.meanCount;
-            double interEvDistance = computeDistance(event, neighbEv); 
+            double interEvDistance = _distCache->compute(event, neighbEv);
             statsByInterEvDistance[ int(interEvDistance/EV_DIST_STEP) ] += neighStats;
         }
 
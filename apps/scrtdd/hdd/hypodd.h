@@ -22,12 +22,15 @@
 #include "wfmngr.h"
 #include "solver.h"
 #include "clustering.h"
+#include "ttcache.h"
+#include "distcache.h"
 #include "xcorrcache.ipp"
 
 #include <seiscomp3/core/baseobject.h>
 #include <seiscomp3/seismology/ttt.h>
 
 #include <unordered_map>
+#include <list>
 #include <map>
 #include <unordered_set>
 #include <vector>
@@ -37,6 +40,15 @@ namespace HDD {
 
 struct Config {
 
+    // number of threads used by the parallelized computations (0 = all available cores)
+    unsigned numThreads = 1;
+
+    // cache of the neighbouring events selected for single event relocations
+    struct {
+        unsigned maxEntries = 50;      // 0 = disabled
+        double locationTolerance = 0;  // km, 0 = only identical locations
+    } neighboursCache;
+
     std::vector<std::string> validPphases = {"Pg","P","Px"};
     std::vector<std::string> validSphases = {"Sg","S","Sx"};
 
@@ -107,11 +119,17 @@ struct Config {
     struct {
         std::string type  = "LOCSAT";
         std::string model = "iasp91";
+        double cacheGridSpacing = 0; // km, 0 = cache exact source positions only
+        std::string gridFile; // precomputed travel time grid (empty = not used)
+        double gridSpacing = 1.0; // km, used when generating gridFile
+        double gridMargin = 10.0; // km, used when generating gridFile
     } ttt;
 
     struct {
         std::string type = "LSMR"; // LSMR or LSQR
         bool L2normalization = true;
+        bool blockJacobiPreconditioning = false;
+        bool validatePartialDerivatives = false;
         unsigned solverIterations = 0;
         unsigned algoIterations = 20; 
         double dampingFactorStart = 0.;
@@ -123,6 +141,16 @@ struct Config {
         bool usePickUncertainty = false;
         double absTTDiffObsWeight = 1.0;
         double xcorrObsWeight = 1.0; 
+
+        // Stop the iterations when the events do not move anymore and the
+        // residuals/weights are stable
+        struct {
+            bool enable = false;
+            double maxShift = 0.05;         // km
+            double rmsShift = 0.01;         // km
+            double residualRMSChange = 0.01;  // relative
+            double changedWeightsFraction = 0.02;
+        } convergence;
     } solver;
 };
 
@@ -145,6 +173,7 @@ class HypoDD : public Core::BaseObject {
         CatalogPtr relocateCatalog();
         CatalogPtr relocateSingleEvent(const CatalogCPtr& orgToRelocate);
         void evalXCorr();
+        void generateTravelTimeGrid() const;
 
         void setWorkingDirCleanup(bool cleanup) { _workingDirCleanup = cleanup; }
         bool workingDirCleanup() const { return _workingDirCleanup; }
@@ -172,7 +201,15 @@ class HypoDD : public Core::BaseObject {
                                 bool computeTheoreticalPhases, double minPhaseWeight,
                                 double minESdist, double maxESdist, double minEStoIEratio,
                                 int minDTperEvt, int maxDTperEvt, int minNumNeigh, int maxNumNeigh,
-                                int numEllipsoids, double maxEllipsoidSize);
+                                int numEllipsoids, double maxEllipsoidSize,
+                                CandidateScan& candidateScan);
+
+        NeighboursPtr selectNeighbouringEventsCached(const Catalog::Event& refEv,
+                                const CatalogCPtr& refEvCatalog, double minPhaseWeight,
+                                double minESdist, double maxESdist, double minEStoIEratio,
+                                int minDTperEvt, int maxDTperEvt, int minNumNeigh, int maxNumNeigh,
+                                int numEllipsoids, double maxEllipsoidSize, bool keepUnmatched,
+                                CandidateScan& candidateScan);
 
         CatalogPtr relocate(CatalogPtr& catalog, const std::list<NeighboursPtr>& neighbourCats, 
                             bool keepNeighboursFixed, const XCorrCache& xcorr) const;
@@ -183,13 +220,32 @@ class HypoDD : public Core::BaseObject {
                 Catalog::Station station;
                 char phaseType;
                 double travelTime;
+                bool changed; // not yet added to the solver
             };
-            void add(TravelTimeTableInterfacePtr ttt, const Catalog::Event& event,
+            void add(TravelTimeCachePtr ttt, const Catalog::Event& event,
                      const Catalog::Station& station, char phaseType);
             const Entry& get(unsigned eventId, const std::string stationId, char phaseType ) const;
-            void addToSolver(Solver& solver) const;
+            void update(TravelTimeCachePtr ttt, const CatalogCPtr& catalog);
+            void addToSolver(Solver& solver);
             private:
-            std::unordered_map<std::string,Entry> _entries;
+            struct Key {
+                unsigned eventId;
+                std::string stationId;
+                char phaseType;
+                bool operator==(const Key& other) const
+                {
+                    return eventId == other.eventId && phaseType == other.phaseType &&
+                           stationId == other.stationId;
+                }
+            };
+            struct KeyHasher {
+                size_t operator()(const Key& key) const
+                {
+                    return std::hash<std::string>()(key.stationId) ^
+                           (size_t(key.eventId) << 8) ^ size_t(uint8_t(key.phaseType));
+                }
+            };
+            std::unordered_map<Key,Entry,KeyHasher> _entries;
         }; 
 
         void addObservations(Solver& solver, const CatalogCPtr& catalog,
@@ -197,6 +253,12 @@ class HypoDD : public Core::BaseObject {
                              bool keepNeighboursFixed, const XCorrCache& xcorr,
                              ObservationParams& obsparams ) const;
 
+        bool updateObservations(Solver& solver,
+                                const CatalogCPtr& prevCatalog,
+                                const CatalogCPtr& catalog,
+                                const std::list<NeighboursPtr>& neighbourCats,
+                                ObservationParams& obsparams ) const;
+
         CatalogPtr updateRelocatedEvents(const Solver& solver,
                                          const CatalogCPtr& catalog,
                                          const std::list<NeighboursPtr>& neighbourCats,
@@ -274,6 +336,16 @@ class HypoDD : public Core::BaseObject {
 
         CatalogCPtr _srcCat;
         CatalogCPtr _ddbgc;
+        EventSpatialIndexCPtr _ddbgcIndex; // spatial index of _ddbgc events
+
+        // neighbouring events selected for single event relocations, most recently used first
+        struct NeighboursCacheEntry {
+            Catalog::Event refEv;
+            std::vector<std::pair<std::string,Catalog::Phase::Type>> refEvPhases; // sorted
+            std::vector<double> params; // selection parameters
+            NeighboursCPtr neighbours;
+        };
+        std::list<NeighboursCacheEntry> _neighboursCache;
 
         const Config _cfg;
 
@@ -285,7 +357,8 @@ class HypoDD : public Core::BaseObject {
 
         bool _useArtificialPhases = true;
 
-        TravelTimeTableInterfacePtr _ttt;
+        TravelTimeCachePtr _ttt;
+        DistanceCachePtr _distCache; // event-station and inter-event distances
 
         struct {
             unsigned xcorr_performed;
@@ -0,0 +1,117 @@
+/***************************************************************************
+ *   Copyright (C) by ETHZ/SED                                             *
+ *                                                                         *
+ * This program is free software: you can redistribute it and/or modify    *
+ * it under the terms of the GNU Affero General Public License as published*
+ * by the Free Software Foundation, either version 3 of the License, or    *
+ * (at your option) any later version.                                     *
+ *                                                                         *
+ * This program is distributed in the hope that it will be useful,         *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of          *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           *
+ * GNU Affero General Public License for more details.                     *
+ *                                                                         *
+ *                                                                         *
+ *   Developed by Luca Scarabello <luca.scarabello@sed.ethz.ch>            *
+ ***************************************************************************/
+
+#ifndef __RTDD_APPLICATIONS_INTERNED_H__
+#define __RTDD_APPLICATIONS_INTERNED_H__
+
+#include <string>
+#include <unordered_set>
+#include <mutex>
+#include <ostream>
+#include <functional>
+
+
+namespace Seiscomp {
+namespace HDD {
+
+/*
+ * Immutable string stored once per process and referenced by a pointer.
+ *
+ * Catalog phases repeat the same few codes (station ids, network, station,
+ * location and channel codes, phase types) millions of times: interning them
+ * makes phases much smaller, their copy a pointer copy and their comparison a
+ * pointer comparison. The strings are never released, which is fine for
+ * codes, but this is not meant for arbitrary text.
+ *
+ * It converts implicitly to const std::string& so that it can be used
+ * wherever a string is expected.
+ */
+class InternedString {
+
+    public:
+
+        InternedString() : _str(intern(std::string())) { }
+        InternedString(const std::string& str) : _str(intern(str)) { }
+        InternedString(const char* str) : _str(intern(str)) { }
+
+        InternedString& operator=(const std::string& str) { _str = intern(str); return *this; }
+        InternedString& operator=(const char* str) { _str = intern(str); return *this; }
+
+        const std::string& str() const { return *_str; }
+        operator const std::string&() const { return *_str; }
+
+        const char* c_str() const { return _str->c_str(); }
+        size_t size() const { return _str->size(); }
+        bool empty() const { return _str->empty(); }
+        char operator[](size_t pos) const { return (*_str)[pos]; }
+        std::string substr(size_t pos = 0, size_t len = std::string::npos) const
+        {
+            return _str->substr(pos, len);
+        }
+
+        // equal strings are interned only once
+        bool operator==(const InternedString& other) const { return _str == other._str; }
+        bool operator!=(const InternedString& other) const { return _str != other._str; }
+        bool operator<(const InternedString& other) const { return *_str < *other._str; }
+
+    private:
+
+        static const std::string* intern(const std::string& str)
+        {
+            // never destroyed: interned strings might be used by static objects
+            static std::unordered_set<std::string>* pool = new std::unordered_set<std::string>();
+            static std::mutex* poolMtx = new std::mutex();
+
+            std::lock_guard<std::mutex> lock(*poolMtx);
+            return &*pool->insert(str).first;
+        }
+
+        const std::string* _str;
+};
+
+inline bool operator==(const InternedString& lhs, const std::string& rhs) { return lhs.str() == rhs; }
+inline bool operator==(const std::string& lhs, const InternedString& rhs) { return lhs == rhs.str(); }
+inline bool operator==(const InternedString& lhs, const char* rhs) { return lhs.str() == rhs; }
+inline bool operator==(const char* lhs, const InternedString& rhs) { return lhs == rhs.str(); }
+inline bool operator!=(const InternedString& lhs, const std::string& rhs) { return lhs.str() != rhs; }
+inline bool operator!=(const std::string& lhs, const InternedString& rhs) { return lhs != rhs.str(); }
+inline bool operator!=(const InternedString& lhs, const char* rhs) { return lhs.str() != rhs; }
+inline bool operator!=(const char* lhs, const InternedString& rhs) { return lhs != rhs.str(); }
+
+inline std::string operator+(const InternedString& lhs, const std::string& rhs) { return lhs.str() + rhs; }
+inline std::string operator+(const std::string& lhs, const InternedString& rhs) { return lhs + rhs.str(); }
+inline std::string operator+(const InternedString& lhs, const char* rhs) { return lhs.str() + rhs; }
+inline std::string operator+(const char* lhs, const InternedString& rhs) { return lhs + rhs.str(); }
+inline std::string operator+(const InternedString& lhs, const InternedString& rhs) { return lhs.str() + rhs.str(); }
+
+inline std::ostream& operator<<(std::ostream& os, const InternedString& str) { return os << str.str(); }
+
+}
+}
+
+namespace std {
+
+template <> struct hash<Seiscomp::HDD::InternedString> {
+    size_t operator()(const Seiscomp::HDD::InternedString& str) const
+    {
+        return hash<const std::string*>()(&str.str());
+    }
+};
+
+}
+
+#endif
@@ -17,6 +17,7 @@
  *=========================================================================*/
 
 #include "lsmr.h"
+#include "blas1.h"
 
 #include <algorithm>
 #include <cmath>
@@ -27,14 +28,6 @@
 namespace Seiscomp {
 namespace HDD {
  
-inline void daxpy( unsigned int n, double alpha, const double * x, double * y )
-{
-  const double * xend = x+n;
-  while ( x!=xend ) {
-    *y++ += alpha * *x++;
-  }
-}
-
 #define Sqr(x) ((x)*(x))
 
 lsmrBase::lsmrBase()
@@ -235,46 +228,13 @@ lsmrBase::D2Norm( double a, double b ) const
 void
 lsmrBase::Scale( unsigned int n, double factor, double *x ) const
 {
-  double * xend = x + n;
-  while( x != xend )
-    {
-      *x++ *= factor;
-    }
+  Blas1::scal( n, factor, x );
 }
 
 double
 lsmrBase::Dnrm2( unsigned int n, const double *x ) const
 {
-  double magnitudeOfLargestElement = 0.0;
-
-  double sumOfSquaresScaled = 1.0;
-
-  for ( unsigned int i = 0; i < n; i++ )
-    {
-      if ( x[i] != 0.0 )
-	{
-	  double dx = x[i];
-	  const double absxi = std::abs(dx);
-
-	  if ( magnitudeOfLargestElement < absxi )
-	    {
-	      // rescale the sum to the range of the new element
-	      dx = magnitudeOfLargestElement / absxi;
-	      sumOfSquaresScaled = sumOfSquaresScaled * (dx * dx) + 1.0;
-	      magnitudeOfLargestElement = absxi;
-	    }
-	  else
-	    {
-	      // rescale the new element to the range of the sum
-	      dx = absxi / magnitudeOfLargestElement;
-	      sumOfSquaresScaled += dx * dx;
-	    }
-	}
-    }
-
-  const double norm = magnitudeOfLargestElement * sqrt( sumOfSquaresScaled );
-
-  return norm;
+  return Blas1::nrm2( n, x );
 }
 
 /**
@@ -454,8 +414,8 @@ Solve( unsigned int m, unsigned int n, const double * b, double * x )
 
 	  for( unsigned int localOrthoCount =0; localOrthoCount<localOrthoLimit;
 	       ++localOrthoCount) {
-	    double d = std::inner_product(v,v+n,localV+n*localOrthoCount,0.0);
-	    daxpy( n, -d, localV+localOrthoCount*n, v );
+	    double d = Blas1::dot( n, v, localV+n*localOrthoCount );
+	    Blas1::axpy( n, -d, localV+localOrthoCount*n, v );
 	  }
 	}
 
@@ -500,10 +460,13 @@ Solve( unsigned int m, unsigned int n, const double * b, double * x )
 
     // Update h, h_hat, x.
 
+    const double hbarFactor = thetabar*rho/(rhoold*rhobarold);
+    const double xFactor = zeta/(rho*rhobar);
+    const double hFactor = thetanew/rho;
     for( unsigned int i=0;i<n;++i) {
-      hbar[i] = h[i] - (thetabar*rho/(rhoold*rhobarold))*hbar[i];
-      x[i] = x[i] + (zeta/(rho*rhobar))*hbar[i];
-      h[i] = v[i] - (thetanew/rho)*h[i];
+      hbar[i] = h[i] - hbarFactor*hbar[i];
+      x[i] = x[i] + xFactor*hbar[i];
+      h[i] = v[i] - hFactor*h[i];
     }
 
     // Estimate ||r||.
@@ -17,6 +17,7 @@
  *=========================================================================*/
 
 #include "lsqr.h"
+#include "blas1.h"
 
 #include <cmath>
 #include <iostream>
@@ -225,11 +226,7 @@ lsqrBase::D2Norm( double a, double b ) const
 void
 lsqrBase::Scale( unsigned int n, double factor, double *x ) const
 {
-  double * xend = x + n;
-  while( x != xend )
-    {
-    *x++ *= factor;
-    }
+  Blas1::scal( n, factor, x );
 }
 
 
@@ -237,36 +234,7 @@ lsqrBase::Scale( unsigned int n, double factor, double *x ) const
 double
 lsqrBase::Dnrm2( unsigned int n, const double *x ) const
 {
-  double magnitudeOfLargestElement = 0.0;
-
-  double sumOfSquaresScaled = 1.0;
-
-  for ( unsigned int i = 0; i < n; i++ )
-    {
-    if ( x[i] != 0.0 ) 
-      {
-      double dx = x[i];
-      const double absxi = std::abs(dx);
-
-      if ( magnitudeOfLargestElement < absxi ) 
-        {
-        // rescale the sum to the range of the new element
-        dx = magnitudeOfLargestElement / absxi;
-        sumOfSquaresScaled = sumOfSquaresScaled * (dx * dx) + 1.0;
-        magnitudeOfLargestElement = absxi;
-        }
-      else
-        {
-        // rescale the new element to the range of the sum
-        dx = absxi / magnitudeOfLargestElement;
-        sumOfSquaresScaled += dx * dx;
-        }
-      }
-    }
-
-  const double norm = magnitudeOfLargestElement * sqrt( sumOfSquaresScaled );
-
-  return norm;
+  return Blas1::nrm2( n, x );
 }
 
 
@@ -490,31 +458,22 @@ Solve( unsigned int m, unsigned int n, const double * b, double * x )
     double t1     =     phi / rho;
     double t2     = - theta / rho;
     double t3     =     one / rho;
-    double dknorm =    zero;
+    // dknorm = norm( d_k )^2, with d_k = t3 * w
+    double dknorm = t3 * t3 * Blas1::dot( n, w, w );
 
-    if ( this->wantse ) 
+    if ( this->wantse )
       {
       for ( unsigned int i = 0; i < n; i++ )
         {
-        double t = w[i];
-        x[i]   = t1 * t +  x[i];
-        w[i]   = t2 * t +  v[i];
-        t      = ( t3 * t ) * ( t3 * t );
-        se[i]  = t + se[i];
-        dknorm = t + dknorm;
-        }
-      }
-    else
-      {
-      for ( unsigned int i = 0; i < n; i++ )
-        {
-        double t = w[i];
-        x[i]   = t1 * t + x[i];
-        w[i]   = t2 * t + v[i];
-        dknorm = ( t3 * t )*( t3 * t ) + dknorm;
+        double t = t3 * w[i];
+        se[i] = t * t + se[i];
         }
       }
 
+    Blas1::axpy( n, t1, w, x );     // x = x + t1 * w
+    Blas1::scal( n, t2, w );
+    Blas1::axpy( n, one, v, w );    // w = v + t2 * w
+
 
     //----------------------------------------------------------------
     //  Monitor the norm of d_k, the update to x.
@@ -20,6 +20,13 @@
 
 #include <stdexcept>
 #include <sstream>
+#include <algorithm>
+#include <numeric>
+#include <tuple>
+#include <limits>
+#include <atomic>
+#include <thread>
+#include <chrono>
 #include <seiscomp3/math/geo.h>
 #include <seiscomp3/math/math.h>
 #include <seiscomp3/core/strings.h>
@@ -32,6 +39,28 @@ using Seiscomp::Core::stringify;
 
 namespace {
 
+uint64_t phStaKey(unsigned staIdx, char phase)
+{
+    return (uint64_t(staIdx) << 8) | uint8_t(phase);
+}
+
+uint64_t obsParamsKey(unsigned evIdx, unsigned phStaIdx)
+{
+    return (uint64_t(evIdx) << 32) | phStaIdx;
+}
+
+// Below these sizes the threads overhead is higher than the gain
+constexpr unsigned MinCoordsPerThread = 500;
+constexpr unsigned MinObsParamsPerThread = 5000;
+
+// Residual weights (0-1) changing less than this are considered unchanged
+constexpr double WeightChangeTolerance = 0.05;
+
+double secondsSince(const std::chrono::steady_clock::time_point& start)
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
 /**
  * Common DDSystem adapter for both LSQR and LSMR solvers
  * T can be lsqrBase or lsmrBase
@@ -42,12 +71,18 @@ class Adapter : public T
 
 public:
 
-    Adapter() { }
+    // Below these sizes the threads overhead is higher than the gain
+    static constexpr unsigned MinObsPerThread = 20000;
+    static constexpr unsigned MinEventsPerThread = 500;
+
+    // The threads are created once and used by all the solver iterations
+    Adapter(unsigned numThreads = 1) : _threads(numThreads) { }
     virtual ~Adapter() { }
 
     void setDDSytem(const Seiscomp::HDD::DDSystemPtr& dd)
     {
         _dd = dd;
+        buildObsByEvent();
     }
 
     /*
@@ -56,70 +91,227 @@ public:
      */
     void L2normalize()
     {
-        std::fill_n(_dd->L2NScaler, _dd->numColsG, 0.);
+        double const* meanShiftWeight = &_dd->W[_dd->nObs];
+        const bool meanShift = meanShiftWeight[0] != 0 || meanShiftWeight[1] != 0 ||
+                               meanShiftWeight[2] != 0 || meanShiftWeight[3] != 0;
 
-        for ( unsigned int ob = 0; ob < _dd->nObs; ob++ )
+        auto kernel = [this, meanShiftWeight, meanShift](unsigned evBegin, unsigned evEnd)
         {
-            const double obsW = _dd->W[ob];
-            if ( obsW == 0. )
-                continue;
-
-            const unsigned phStaIdx = _dd->phStaByObs[ob]; // station for this observation
-
-            const int evIdx1 = _dd->evByObs[ob][0]; // event 1 for this observation
-            if ( evIdx1 >= 0 )
+            for ( unsigned evIdx = evBegin; evIdx < evEnd; evIdx++ )
             {
-                const unsigned idxG = evIdx1 * _dd->nPhStas + phStaIdx;
-                const unsigned evOffset = evIdx1 * 4;
-                _dd->L2NScaler[evOffset+0] += std::pow(_dd->G[idxG][0] * obsW, 2);
-                _dd->L2NScaler[evOffset+1] += std::pow(_dd->G[idxG][1] * obsW, 2);
-                _dd->L2NScaler[evOffset+2] += std::pow(_dd->G[idxG][2] * obsW, 2);
-                _dd->L2NScaler[evOffset+3] += std::pow(_dd->G[idxG][3] * obsW, 2);
+                const unsigned evOffset = evIdx * 4;
+                double *scaler = &_dd->L2NScaler[evOffset];
+                std::fill_n(scaler, 4, 0.);
+
+                for ( unsigned i = _evObsOffset[evIdx]; i < _evObsOffset[evIdx+1]; i++ )
+                {
+                    const unsigned ob = _evObs[i] >> 1;
+                    const double obsW = _dd->W[ob];
+                    const unsigned idxG = _dd->idxGByObs[ob][_evObs[i] & 1];
+                    scaler[0] += std::pow(_dd->G[idxG][0] * obsW, 2);
+                    scaler[1] += std::pow(_dd->G[idxG][1] * obsW, 2);
+                    scaler[2] += std::pow(_dd->G[idxG][2] * obsW, 2);
+                    scaler[3] += std::pow(_dd->G[idxG][3] * obsW, 2);
+                }
+
+                if ( meanShift && hasObservations(evIdx) )
+                {
+                    scaler[0] += std::pow(meanShiftWeight[0], 2);
+                    scaler[1] += std::pow(meanShiftWeight[1], 2);
+                    scaler[2] += std::pow(meanShiftWeight[2], 2);
+                    scaler[3] += std::pow(meanShiftWeight[3], 2);
+                }
+
+                // the empty columns of the events without observations are left as they are
+                for ( unsigned k = 0; k < 4; k++ )
+                    scaler[k] = scaler[k] > 0 ? 1. / std::sqrt(scaler[k]) : 1.;
             }
+        };
 
-            const int evIdx2 = _dd->evByObs[ob][1]; // event 2 for this observation
-            if ( evIdx2 >= 0 )
-            {
-                const unsigned idxG = evIdx2 * _dd->nPhStas + phStaIdx;
-                const unsigned evOffset = evIdx2 * 4;
-                _dd->L2NScaler[evOffset+0] += std::pow(_dd->G[idxG][0] * obsW, 2);
-                _dd->L2NScaler[evOffset+1] += std::pow(_dd->G[idxG][1] * obsW, 2);
-                _dd->L2NScaler[evOffset+2] += std::pow(_dd->G[idxG][2] * obsW, 2);
-                _dd->L2NScaler[evOffset+3] += std::pow(_dd->G[idxG][3] * obsW, 2);
-            }
+        _threads.parallelFor(_dd->nEvts, MinEventsPerThread, kernel);
+        _normalized = true;
+    }
+
+    /*
+     * Rescale m back to the initial scaling
+     */
+    void L2DeNormalize()
+    {
+        for (unsigned evOffset = 0; evOffset < _dd->numColsG; evOffset += 4 )
+        {
+            _dd->m[evOffset+0] *= _dd->L2NScaler[evOffset+0];
+            _dd->m[evOffset+1] *= _dd->L2NScaler[evOffset+1];
+            _dd->m[evOffset+2] *= _dd->L2NScaler[evOffset+2];
+            _dd->m[evOffset+3] *= _dd->L2NScaler[evOffset+3];
         }
+    }
+
+    /*
+     * Right block-Jacobi preconditioning: the 4 columns of each event are
+     * transformed by the inverse of the Cholesky factor R of their 4x4 block
+     * of A'*A (A'*A = R'*R), so that they become orthonormal. This
+     * decorrelates the location and origin time parameters of each event
+     * and reduces the number of iterations required by the solver.
+     * Events whose block is singular are not preconditioned.
+     * Note that the damping applies to the preconditioned parameters.
+     * This must be called after L2normalize and before prepare
+     */
+    void blockJacobiPrecondition()
+    {
+        // The blocks are built from the coefficients without preconditioning,
+        // so _precond is set only when all the blocks are factored
+        _precond.clear();
+        vector<double> precond(_dd->nEvts * 16, 0.);
 
         double const* meanShiftWeight = &_dd->W[_dd->nObs];
-        if ( meanShiftWeight[0] != 0 || meanShiftWeight[1] != 0 ||
-             meanShiftWeight[2] != 0 || meanShiftWeight[3] != 0 )
+
+        auto kernel = [this, meanShiftWeight, &precond](unsigned evBegin, unsigned evEnd)
         {
-            for (unsigned evOffset = 0; evOffset < _dd->numColsG; evOffset += 4 )
+            for ( unsigned evIdx = evBegin; evIdx < evEnd; evIdx++ )
             {
-                _dd->L2NScaler[evOffset+0] += std::pow(meanShiftWeight[0], 2);
-                _dd->L2NScaler[evOffset+1] += std::pow(meanShiftWeight[1], 2);
-                _dd->L2NScaler[evOffset+2] += std::pow(meanShiftWeight[2], 2);
-                _dd->L2NScaler[evOffset+3] += std::pow(meanShiftWeight[3], 2); 
+                const unsigned evOffset = evIdx * 4;
+                double B[4][4] = { {0} }; // lower triangle of the event block of A'*A
+
+                for ( unsigned i = _evObsOffset[evIdx]; i < _evObsOffset[evIdx+1]; i++ )
+                {
+                    double a[4];
+                    coefficients(_evObs[i] >> 1, _evObs[i] & 1, evOffset, a);
+                    for ( unsigned r = 0; r < 4; r++ )
+                        for ( unsigned c = 0; c <= r; c++ )
+                            B[r][c] += a[r] * a[c];
+                }
+
+                for ( unsigned k = 0; hasObservations(evIdx) && k < 4; k++ )
+                    B[k][k] += std::pow(meanShiftWeight[k] * _dd->L2NScaler[evOffset+k], 2);
+
+                double *Rinv = &precond[evIdx * 16];
+                if ( ! invertedCholesky(B, Rinv) )
+                {
+                    std::fill_n(Rinv, 16, 0.);
+                    Rinv[0] = Rinv[5] = Rinv[10] = Rinv[15] = 1.;
+                }
             }
-        }
+        };
+
+        _threads.parallelFor(_dd->nEvts, MinEventsPerThread, kernel);
+        _precond = std::move(precond);
+    }
 
-        for ( unsigned col = 0; col < _dd->numColsG; col++)
+    /*
+     * Transform m back from the preconditioned parameters
+     */
+    void blockJacobiDePrecondition()
+    {
+        for (unsigned evOffset = 0; evOffset < _dd->numColsG; evOffset += 4 )
         {
-            _dd->L2NScaler[col] = 1. / std::sqrt(_dd->L2NScaler[col]);
+            const double *Rinv = &_precond[evOffset * 4];
+            double *m = &_dd->m[evOffset];
+            for ( unsigned k = 0; k < 4; k++ )
+            {
+                // Rinv is upper triangular and m[j] with j < k are already updated
+                double value = 0;
+                for ( unsigned j = k; j < 4; j++ )
+                    value += Rinv[k*4+j] * m[j];
+                m[k] = value;
+            }
         }
     }
 
     /*
-     * Rescale m back to the initial scaling
+     * Precompute the coefficients of A = W*G*L2NScaler used by Aprod1 and
+     * Aprod2. This must be called after L2normalize, since W and L2NScaler
+     * don't change during the solver iterations.
+     * The coefficients are stored twice, in observation order (Aprod1) and in
+     * event order (Aprod2), each one as contiguous arrays so that the solver
+     * iterations only stream through memory. Observations with zero weight are
+     * not part of the arrays, while the mean shift equations are handled
+     * separately since they involve all the events
      */
-    void L2DeNormalize()
+    void prepare()
     {
-        for (unsigned evOffset = 0; evOffset < _dd->numColsG; evOffset += 4 )
+        // Observation order: one row for each non-zero weight observation
+        _rowObs.clear();
+        for ( unsigned int ob = 0; ob < _dd->nObs; ob++ )
         {
-            _dd->m[evOffset+0] *= _dd->L2NScaler[evOffset+0];
-            _dd->m[evOffset+1] *= _dd->L2NScaler[evOffset+1];
-            _dd->m[evOffset+2] *= _dd->L2NScaler[evOffset+2];
-            _dd->m[evOffset+3] *= _dd->L2NScaler[evOffset+3];
+            if ( _dd->W[ob] != 0. )
+                _rowObs.push_back(ob);
+        }
+
+        const unsigned nRows = _rowObs.size();
+        for ( unsigned side = 0; side < 2; side++ )
+        {
+            _rowCol[side].resize(nRows);
+            for ( unsigned k = 0; k < 4; k++ )
+                _rowCoef[side][k].resize(nRows);
         }
+
+        auto rowKernel = [this](unsigned rowBegin, unsigned rowEnd)
+        {
+            for ( unsigned r = rowBegin; r < rowEnd; r++ )
+            {
+                const unsigned ob = _rowObs[r];
+                for ( unsigned side = 0; side < 2; side++ )
+                {
+                    // event 1 has positive derivatives, event 2 negative ones
+                    const int evIdx = _dd->evByObs[ob][side];
+                    if ( evIdx >= 0 )
+                    {
+                        const unsigned evOffset = evIdx * 4;
+                        double a[4];
+                        coefficients(ob, side, evOffset, a);
+                        _rowCol[side][r] = evOffset;
+                        for ( unsigned k = 0; k < 4; k++ )
+                            _rowCoef[side][k][r] = a[k];
+                    }
+                    else
+                    {
+                        // no parameters for this event: a zero coefficient
+                        // avoids branching in Aprod1
+                        _rowCol[side][r] = 0;
+                        for ( unsigned k = 0; k < 4; k++ )
+                            _rowCoef[side][k][r] = 0.;
+                    }
+                }
+            }
+        };
+        _threads.parallelFor(nRows, MinObsPerThread, rowKernel);
+
+        // Event order: same coefficients following the layout of _evObs
+        for ( unsigned k = 0; k < 4; k++ )
+            _colCoef[k].resize(_evObs.size());
+
+        auto colKernel = [this](unsigned evBegin, unsigned evEnd)
+        {
+            for ( unsigned evIdx = evBegin; evIdx < evEnd; evIdx++ )
+            {
+                const unsigned evOffset = evIdx * 4;
+                for ( unsigned i = _evObsOffset[evIdx]; i < _evObsOffset[evIdx+1]; i++ )
+                {
+                    double a[4];
+                    coefficients(_evObs[i] >> 1, _evObs[i] & 1, evOffset, a);
+                    for ( unsigned k = 0; k < 4; k++ )
+                        _colCoef[k][i] = a[k];
+                }
+            }
+        };
+        _threads.parallelFor(_dd->nEvts, MinEventsPerThread, colKernel);
+
+        // Select the Aprod kernels once, instead of checking the configuration
+        // at each solver iteration
+        bool bothEvents = false;
+        for ( unsigned r = 0; r < nRows && ! bothEvents; r++ )
+            bothEvents = _dd->evByObs[_rowObs[r]][1] >= 0;
+
+        const double *meanShiftWeight = &_dd->W[_dd->nObs];
+        if ( meanShiftWeight[0] == 0 && meanShiftWeight[1] == 0 &&
+             meanShiftWeight[2] == 0 && meanShiftWeight[3] == 0 )
+            selectKernels<MeanShift::None>(bothEvents);
+        else if ( ! _precond.empty() )
+            selectKernels<MeanShift::Preconditioned>(bothEvents);
+        else if ( _normalized )
+            selectKernels<MeanShift::Scaled>(bothEvents);
+        else
+            selectKernels<MeanShift::Unscaled>(bothEvents);
     }
 
     /**
@@ -129,6 +321,8 @@ public:
      * where A is a matrix of dimensions A[m][n].
      * The size of the vector x is n.
      * The size of the vector y is m.
+     *
+     * The kernel specialized for this system is selected by prepare()
      */
     void Aprod1(unsigned int m, unsigned int n, const double * x, double * y ) const
     {
@@ -138,124 +332,326 @@ public:
                                    m, n, _dd->numRowsG, _dd->numColsG);
             throw std::runtime_error(msg.c_str());
         }
+        (this->*_aprod1)(x, y);
+    }
 
-        for ( unsigned int ob = 0; ob < _dd->nObs; ob++ )
+    /**
+     * Required by lsqrBase and lsmrBase:
+     *
+     * computes x = x + A'*y without altering y,
+     * where A is a matrix of dimensions A[m][n].
+     * The size of the vector x is n.
+     * The size of the vector y is m.
+     *
+     * The kernel specialized for this system is selected by prepare()
+     */
+    void Aprod2(unsigned int m, unsigned int n, double * x, const double * y ) const
+    {
+        if ( m != _dd->numRowsG || n != _dd->numColsG )
         {
-            if ( _dd->W[ob] == 0. )
-                continue;
+            string msg = stringify("Solver: Internal logic error (m=%u n=%u but G=%ux%u)",
+                                   m, n, _dd->numRowsG, _dd->numColsG);
+            throw std::runtime_error(msg.c_str());
+        }
+        (this->*_aprod2)(x, y);
+    }
 
-            const unsigned phStaIdx = _dd->phStaByObs[ob]; // station for this observation
-            double sum = 0;
+private:
 
-            const int evIdx1 = _dd->evByObs[ob][0]; // event 1 for this observation
-            if ( evIdx1 >= 0 )
-            {
-                const unsigned idxG = evIdx1 * _dd->nPhStas + phStaIdx;
-                const unsigned evOffset = evIdx1 * 4;
-                sum += _dd->G[idxG][0] * _dd->L2NScaler[evOffset+0] * x[evOffset+0];
-                sum += _dd->G[idxG][1] * _dd->L2NScaler[evOffset+1] * x[evOffset+1];
-                sum += _dd->G[idxG][2] * _dd->L2NScaler[evOffset+2] * x[evOffset+2];
-                sum += _dd->G[idxG][3] * _dd->L2NScaler[evOffset+3] * x[evOffset+3];
-            }
+    // How the mean shift constraints enter A (none, scaled by L2NScaler or
+    // also preconditioned)
+    enum class MeanShift { None, Unscaled, Scaled, Preconditioned };
 
-            const int evIdx2 = _dd->evByObs[ob][1]; // event 2 for this observation
-            if ( evIdx2 >= 0 )
+    template <MeanShift M>
+    void selectKernels(bool bothEvents)
+    {
+        _aprod1 = bothEvents ? &Adapter::template aprod1<M, true>
+                             : &Adapter::template aprod1<M, false>;
+        _aprod2 = &Adapter::template aprod2<M>;
+    }
+
+    /*
+     * Aprod1 specialized at compile time, so that the loops don't branch.
+     * When BothEvents is false none of the observations has parameters
+     * for event 2 (e.g. fixed neighbours) and those coefficients are skipped.
+     * Each row of A is independent, so the observations are split among the
+     * threads and every thread writes its own slice of y
+     */
+    template <MeanShift M, bool BothEvents>
+    void aprod1(const double * x, double * y) const
+    {
+        auto kernel = [this, x, y](unsigned rowBegin, unsigned rowEnd)
+        {
+            const unsigned *col1 = _rowCol[0].data(), *col2 = _rowCol[1].data();
+            const double *a1x = _rowCoef[0][0].data(), *a1y = _rowCoef[0][1].data(),
+                         *a1z = _rowCoef[0][2].data(), *a1t = _rowCoef[0][3].data();
+            const double *a2x = _rowCoef[1][0].data(), *a2y = _rowCoef[1][1].data(),
+                         *a2z = _rowCoef[1][2].data(), *a2t = _rowCoef[1][3].data();
+
+            for ( unsigned r = rowBegin; r < rowEnd; r++ )
             {
-                const unsigned idxG = evIdx2 * _dd->nPhStas + phStaIdx;
-                const unsigned evOffset = evIdx2 * 4;
-                sum -= _dd->G[idxG][0] * _dd->L2NScaler[evOffset+0] * x[evOffset+0];
-                sum -= _dd->G[idxG][1] * _dd->L2NScaler[evOffset+1] * x[evOffset+1];
-                sum -= _dd->G[idxG][2] * _dd->L2NScaler[evOffset+2] * x[evOffset+2];
-                sum -= _dd->G[idxG][3] * _dd->L2NScaler[evOffset+3] * x[evOffset+3];
+                const double *x1 = &x[col1[r]]; // event 1 for this observation
+                double value = a1x[r] * x1[0] + a1y[r] * x1[1] + a1z[r] * x1[2] + a1t[r] * x1[3];
+                if ( BothEvents )
+                {
+                    const double *x2 = &x[col2[r]]; // event 2 for this observation
+                    value = value + a2x[r] * x2[0] + a2y[r] * x2[1] + a2z[r] * x2[2] + a2t[r] * x2[3];
+                }
+                y[_rowObs[r]] += value;
             }
+        };
 
-            y[ob] += _dd->W[ob] * sum;
-        }
+        _threads.parallelFor(_rowObs.size(), MinObsPerThread, kernel);
+
+        if ( M == MeanShift::None )
+            return;
 
-        double *meanShiftWeight = &_dd->W[_dd->nObs];
-        if ( meanShiftWeight[0] != 0 || meanShiftWeight[1] != 0 ||
-             meanShiftWeight[2] != 0 || meanShiftWeight[3] != 0 )
+        // The mean shift is a reduction over all events: it is cheap compared
+        // to the observations and it is kept sequential so that the result
+        // does not depend on the number of threads
+        const double *meanShiftWeight = &_dd->W[_dd->nObs];
+        double meanShift[4] = {0};
+        for ( unsigned evIdx = 0; evIdx < _dd->nEvts; evIdx++ )
         {
-            double meanShift[4] = {0};
-            for (unsigned evOffset = 0; evOffset < _dd->numColsG; evOffset += 4 )
+            if ( ! hasObservations(evIdx) )
+                continue;
+
+            const unsigned evOffset = evIdx * 4;
+            if ( M == MeanShift::Unscaled )
+            {
+                meanShift[0] += x[evOffset+0];
+                meanShift[1] += x[evOffset+1];
+                meanShift[2] += x[evOffset+2];
+                meanShift[3] += x[evOffset+3];
+            }
+            else if ( M == MeanShift::Scaled )
             {
                 meanShift[0] += x[evOffset+0] * _dd->L2NScaler[evOffset+0];
                 meanShift[1] += x[evOffset+1] * _dd->L2NScaler[evOffset+1];
                 meanShift[2] += x[evOffset+2] * _dd->L2NScaler[evOffset+2];
-                meanShift[3] += x[evOffset+3] * _dd->L2NScaler[evOffset+3]; 
+                meanShift[3] += x[evOffset+3] * _dd->L2NScaler[evOffset+3];
+            }
+            else
+            {
+                const double *Rinv = &_precond[evOffset * 4];
+                for ( unsigned k = 0; k < 4; k++ )
+                {
+                    double value = 0;
+                    for ( unsigned j = k; j < 4; j++ )
+                        value += Rinv[k*4+j] * x[evOffset+j];
+                    meanShift[k] += value * _dd->L2NScaler[evOffset+k];
+                }
             }
-            y[_dd->nObs+0] += meanShift[0] * meanShiftWeight[0];
-            y[_dd->nObs+1] += meanShift[1] * meanShiftWeight[1];
-            y[_dd->nObs+2] += meanShift[2] * meanShiftWeight[2];
-            y[_dd->nObs+3] += meanShift[3] * meanShiftWeight[3];
         }
+        y[_dd->nObs+0] += meanShift[0] * meanShiftWeight[0];
+        y[_dd->nObs+1] += meanShift[1] * meanShiftWeight[1];
+        y[_dd->nObs+2] += meanShift[2] * meanShiftWeight[2];
+        y[_dd->nObs+3] += meanShift[3] * meanShiftWeight[3];
     }
 
-    /**
-     * Required by lsqrBase and lsmrBase:
-     *
-     * computes x = x + A'*y without altering y,
-     * where A is a matrix of dimensions A[m][n].
-     * The size of the vector x is n.
-     * The size of the vector y is m.
+    /*
+     * Aprod2 specialized at compile time, so that the loops don't branch.
+     * The events are split among the threads and each event accumulates the
+     * contributions of its observations in ascending observation order (see
+     * buildObsByEvent), so the result is the same for any number of threads
      */
-    void Aprod2(unsigned int m, unsigned int n, double * x, const double * y ) const
+    template <MeanShift M>
+    void aprod2(double * x, const double * y) const
     {
-        if ( m != _dd->numRowsG || n != _dd->numColsG )
-        {
-            string msg = stringify("Solver: Internal logic error (m=%u n=%u but G=%ux%u)",
-                                   m, n, _dd->numRowsG, _dd->numColsG);
-            throw std::runtime_error(msg.c_str());
-        }
+        const double *meanShiftWeight = &_dd->W[_dd->nObs];
+        double meanShiftY[4];
+        for ( unsigned k = 0; k < 4; k++ )
+            meanShiftY[k] = meanShiftWeight[k] * y[_dd->nObs+k];
 
-        for ( unsigned int ob = 0; ob < _dd->nObs; ob++ )
+        auto kernel = [this, x, y, meanShiftY](unsigned evBegin, unsigned evEnd)
         {
-            const double wY = y[ob] * _dd->W[ob];
-            if ( wY == 0. )
-                continue;
+            const double *ax = _colCoef[0].data(), *ay = _colCoef[1].data(),
+                         *az = _colCoef[2].data(), *at = _colCoef[3].data();
 
-            const unsigned phStaIdx = _dd->phStaByObs[ob]; // station for this observation
+            for ( unsigned evIdx = evBegin; evIdx < evEnd; evIdx++ )
+            {
+                // nothing to add, not even the mean shift
+                if ( ! hasObservations(evIdx) )
+                    continue;
+
+                const unsigned evOffset = evIdx * 4;
+                double sum[4] = {0};
+
+                for ( unsigned i = _evObsOffset[evIdx]; i < _evObsOffset[evIdx+1]; i++ )
+                {
+                    const double yOb = y[_evObs[i] >> 1];
+                    sum[0] += ax[i] * yOb;
+                    sum[1] += ay[i] * yOb;
+                    sum[2] += az[i] * yOb;
+                    sum[3] += at[i] * yOb;
+                }
+
+                if ( M == MeanShift::Unscaled )
+                {
+                    sum[0] += meanShiftY[0];
+                    sum[1] += meanShiftY[1];
+                    sum[2] += meanShiftY[2];
+                    sum[3] += meanShiftY[3];
+                }
+                else if ( M == MeanShift::Scaled )
+                {
+                    sum[0] += meanShiftY[0] * _dd->L2NScaler[evOffset+0];
+                    sum[1] += meanShiftY[1] * _dd->L2NScaler[evOffset+1];
+                    sum[2] += meanShiftY[2] * _dd->L2NScaler[evOffset+2];
+                    sum[3] += meanShiftY[3] * _dd->L2NScaler[evOffset+3];
+                }
+                else if ( M == MeanShift::Preconditioned )
+                {
+                    const double *Rinv = &_precond[evOffset * 4];
+                    for ( unsigned k = 0; k < 4; k++ )
+                    {
+                        const double value = meanShiftY[k] * _dd->L2NScaler[evOffset+k];
+                        for ( unsigned j = k; j < 4; j++ )
+                            sum[j] += Rinv[k*4+j] * value;
+                    }
+                }
+
+                x[evOffset+0] += sum[0];
+                x[evOffset+1] += sum[1];
+                x[evOffset+2] += sum[2];
+                x[evOffset+3] += sum[3];
+            }
+        };
+
+        _threads.parallelFor(_dd->nEvts, MinEventsPerThread, kernel);
+    }
 
-            const int evIdx1 = _dd->evByObs[ob][0]; // event 1 for this observation
-            if ( evIdx1 >= 0 )
+    /*
+     * Coefficients of A for the parameters of one of the 2 events (side 0 or 1)
+     * of an observation, including the preconditioning, if any
+     */
+    void coefficients(unsigned ob, unsigned side, unsigned evOffset, double a[4]) const
+    {
+        // event 1 has positive derivatives, event 2 negative ones
+        const double obsW = side == 0 ? _dd->W[ob] : -_dd->W[ob];
+        const unsigned idxG = _dd->idxGByObs[ob][side];
+        for ( unsigned k = 0; k < 4; k++ )
+            a[k] = obsW * _dd->G[idxG][k] * _dd->L2NScaler[evOffset+k];
+
+        if ( ! _precond.empty() )
+        {
+            const double *Rinv = &_precond[evOffset * 4];
+            for ( int j = 3; j >= 0; j-- )
             {
-                const unsigned idxG = evIdx1 * _dd->nPhStas + phStaIdx;
-                const unsigned evOffset = evIdx1 * 4;
-                x[evOffset+0] += _dd->G[idxG][0] * _dd->L2NScaler[evOffset+0] * wY;
-                x[evOffset+1] += _dd->G[idxG][1] * _dd->L2NScaler[evOffset+1] * wY;
-                x[evOffset+2] += _dd->G[idxG][2] * _dd->L2NScaler[evOffset+2] * wY;
-                x[evOffset+3] += _dd->G[idxG][3] * _dd->L2NScaler[evOffset+3] * wY;
+                // Rinv is upper triangular and a[k] with k > j are already updated
+                double value = 0;
+                for ( int k = 0; k <= j; k++ )
+                    value += a[k] * Rinv[k*4+j];
+                a[j] = value;
             }
+        }
+    }
 
-            const int evIdx2 = _dd->evByObs[ob][1]; // event 2 for this observation
-            if ( evIdx2 >= 0 )
+    /*
+     * Compute the inverse of the Cholesky factor R of the symmetric matrix B
+     * (of which only the lower triangle is used), B = R'*R. The upper triangular
+     * Rinv is stored row-major. Return false if B is not positive definite
+     */
+    static bool invertedCholesky(const double B[4][4], double Rinv[16])
+    {
+        double R[4][4] = { {0} };
+        for ( unsigned r = 0; r < 4; r++ )
+        {
+            for ( unsigned c = r; c < 4; c++ )
             {
-                const unsigned idxG = evIdx2 * _dd->nPhStas + phStaIdx;
-                const unsigned evOffset = evIdx2 * 4;
-                x[evOffset+0] -= _dd->G[idxG][0] * _dd->L2NScaler[evOffset+0] * wY;
-                x[evOffset+1] -= _dd->G[idxG][1] * _dd->L2NScaler[evOffset+1] * wY;
-                x[evOffset+2] -= _dd->G[idxG][2] * _dd->L2NScaler[evOffset+2] * wY;
-                x[evOffset+3] -= _dd->G[idxG][3] * _dd->L2NScaler[evOffset+3] * wY;
+                double sum = B[c][r];
+                for ( unsigned p = 0; p < r; p++ )
+                    sum -= R[p][r] * R[p][c];
+
+                if ( r == c )
+                {
+                    if ( ! (sum > B[r][r] * std::numeric_limits<double>::epsilon()) )
+                        return false;
+                    R[r][r] = std::sqrt(sum);
+                }
+                else
+                    R[r][c] = sum / R[r][r];
             }
         }
 
-        double *meanShiftWeight = &_dd->W[_dd->nObs];
-        if ( meanShiftWeight[0] != 0 || meanShiftWeight[1] != 0 ||
-             meanShiftWeight[2] != 0 || meanShiftWeight[3] != 0 )
+        std::fill_n(Rinv, 16, 0.);
+        for ( int c = 3; c >= 0; c-- )
         {
-            for (unsigned evOffset = 0; evOffset < _dd->numColsG; evOffset += 4 )
+            Rinv[c*4+c] = 1. / R[c][c];
+            for ( int r = c - 1; r >= 0; r-- )
             {
-                x[evOffset+0] += meanShiftWeight[0] * y[_dd->nObs+0] * _dd->L2NScaler[evOffset+0];
-                x[evOffset+1] += meanShiftWeight[1] * y[_dd->nObs+1] * _dd->L2NScaler[evOffset+1];
-                x[evOffset+2] += meanShiftWeight[2] * y[_dd->nObs+2] * _dd->L2NScaler[evOffset+2];
-                x[evOffset+3] += meanShiftWeight[3] * y[_dd->nObs+3] * _dd->L2NScaler[evOffset+3];
+                double sum = 0;
+                for ( int p = r + 1; p <= c; p++ )
+                    sum += R[r][p] * Rinv[p*4+c];
+                Rinv[r*4+c] = -sum / R[r][r];
             }
         }
+        return true;
     }
 
-private:
+    /*
+     * Build the transpose of evByObs: for each event the list of (observation,
+     * event 1 or 2) pairs referencing it, sorted by observation. This allows
+     * the column-wise operations (Aprod2, L2normalize) to be parallelized by
+     * event without write conflicts. Observations with zero weight are skipped
+     */
+    /*
+     * Events without non-zero weight observations are not relocated, so they
+     * are not part of the mean shift equations either. This is also what
+     * happens when the system is split in clusters, since those events don't
+     * belong to any cluster
+     */
+    bool hasObservations(unsigned evIdx) const
+    {
+        return _evObsOffset[evIdx] != _evObsOffset[evIdx+1];
+    }
+
+    void buildObsByEvent()
+    {
+        _evObsOffset.assign(_dd->nEvts + 1, 0);
+        for ( unsigned int ob = 0; ob < _dd->nObs; ob++ )
+        {
+            if ( _dd->W[ob] == 0. ) continue;
+            if ( _dd->evByObs[ob][0] >= 0 ) _evObsOffset[_dd->evByObs[ob][0] + 1]++;
+            if ( _dd->evByObs[ob][1] >= 0 ) _evObsOffset[_dd->evByObs[ob][1] + 1]++;
+        }
+        for ( unsigned evIdx = 0; evIdx < _dd->nEvts; evIdx++ )
+        {
+            _evObsOffset[evIdx+1] += _evObsOffset[evIdx];
+        }
+
+        _evObs.resize(_evObsOffset[_dd->nEvts]);
+        std::vector<unsigned> next(_evObsOffset.begin(), _evObsOffset.end() - 1);
+        for ( unsigned int ob = 0; ob < _dd->nObs; ob++ )
+        {
+            if ( _dd->W[ob] == 0. ) continue;
+            if ( _dd->evByObs[ob][0] >= 0 ) _evObs[ next[_dd->evByObs[ob][0]]++ ] = ob << 1;
+            if ( _dd->evByObs[ob][1] >= 0 ) _evObs[ next[_dd->evByObs[ob][1]]++ ] = (ob << 1) | 1;
+        }
+    }
 
     Seiscomp::HDD::DDSystemPtr _dd;
+    mutable Seiscomp::HDD::ThreadPool _threads;
+
+    // _evObs[_evObsOffset[evIdx] ... _evObsOffset[evIdx+1]-1]: (ob << 1 | 0 or 1) for event evIdx
+    std::vector<unsigned> _evObsOffset;
+    std::vector<unsigned> _evObs;
+    // _precond[evIdx*16 ... evIdx*16+15]: block-Jacobi preconditioner (upper triangular 4x4)
+    std::vector<double> _precond;
+    // _colCoef[k][i]: coefficient of parameter k (x,y,z,t) for the _evObs[i] entry
+    std::vector<double> _colCoef[4];
+
+    // _rowObs[r]: observation (row of y) of the r-th non-zero weight observation
+    std::vector<unsigned> _rowObs;
+    // _rowCol[0|1][r]: column offset of event 1|2 for row r
+    std::vector<unsigned> _rowCol[2];
+    // _rowCoef[0|1][k][r]: coefficient of parameter k (x,y,z,t) of event 1|2 for row r
+    std::vector<double> _rowCoef[2][4];
+
+    bool _normalized = false;
+    // Aprod1/Aprod2 kernels for the configuration of this system (see prepare)
+    void (Adapter::*_aprod1)(const double *, double *) const = nullptr;
+    void (Adapter::*_aprod2)(double *, const double *) const = nullptr;
 };
 
 
@@ -271,14 +667,13 @@ Solver::addObservation(unsigned evId1, unsigned evId2, const std::string& staId,
                        double observedDiffTime, double aPrioriWeight,
                        bool computeEv1Changes, bool computeEv2Changes, bool isXcorr)
 {
-    string phStaId = string(1,phase) + "@" + staId;
-    string obsId = to_string(evId1) + "+" + to_string(evId2) + "_" + phStaId;
     unsigned evIdx1 = _eventIdConverter.convert(evId1);
     unsigned evIdx2 = _eventIdConverter.convert(evId2);
-    unsigned phStaIdx = _phStaIdConverter.convert(phStaId);
-    unsigned obsIdx = _obsIdConverter.convert(obsId);
-    _observations[obsIdx] = Observation( {evIdx1, evIdx2, phStaIdx, computeEv1Changes,
-            computeEv2Changes, observedDiffTime, aPrioriWeight, isXcorr});
+    unsigned phStaIdx = convertPhStaId(staId, phase);
+    // duplicated observations are removed later (removeDuplicatedObservations)
+    _observations.push_back( Observation( {evIdx1, evIdx2, phStaIdx, computeEv1Changes,
+            computeEv2Changes, observedDiffTime, aPrioriWeight, isXcorr}) );
+    _dd = nullptr; // the system structure changed
 }
 
 
@@ -288,12 +683,68 @@ Solver::addObservationParams(unsigned evId, const std::string& staId, char phase
                              double staLat, double staLon, double staElevation,
                              double travelTime)
 {
-    string phStaId = string(1,phase) + "@" + staId;
-    int evIdx  = _eventIdConverter.convert(evId);
-    unsigned phStaIdx = _phStaIdConverter.convert(phStaId);
+    unsigned evIdx  = _eventIdConverter.convert(evId);
+    unsigned phStaIdx = convertPhStaId(staId, phase);
+
+    if ( evIdx >= _eventParams.size() )
+        _eventParams.resize(evIdx + 1);
     _eventParams[evIdx] = EventParams( {evLat, evLon, evDepth, 0, 0, 0} );
+
+    if ( phStaIdx >= _stationParams.size() )
+        _stationParams.resize(phStaIdx + 1);
     _stationParams[phStaIdx] = StationParams( {staLat, staLon, staElevation, 0, 0, 0} );
-    _obsParams[evIdx][phStaIdx] = ObservationParams( {travelTime, 0, 0, 0, 0} );
+
+    const ObservationParams obsprm( {evIdx, phStaIdx, travelTime, 0, 0, 0, 0} );
+    const auto res = _obsParamsIdx.emplace(obsParamsKey(evIdx, phStaIdx), _obsParams.size());
+    if ( res.second )
+    {
+        _obsParams.push_back(obsprm);
+        _dd = nullptr; // the system structure changed
+    }
+    else
+        _obsParams[res.first->second] = obsprm;
+}
+
+
+void
+Solver::shiftEventOriginTime(unsigned evId, double timeShift)
+{
+    if ( ! _eventIdConverter.hasId(evId) )
+        return;
+
+    unsigned evIdx = _eventIdConverter.toIdx(evId);
+    if ( evIdx >= _eventTimeShifts.size() )
+        _eventTimeShifts.resize(evIdx + 1, 0.);
+    _eventTimeShifts[evIdx] += timeShift;
+}
+
+
+unsigned
+Solver::convertPhStaId(const std::string& staId, char phase)
+{
+    const unsigned staIdx = _staIdConverter.convert(staId);
+    return _phStaIdConverter.convert( phStaKey(staIdx, phase) );
+}
+
+
+bool
+Solver::findObsParamsIdx(unsigned evId, const std::string& staId, char phase,
+                         unsigned& obsParamsIdx) const
+{
+    if ( ! _eventIdConverter.hasId(evId) || ! _staIdConverter.hasId(staId) )
+        return false;
+
+    const uint64_t key = phStaKey(_staIdConverter.toIdx(staId), phase);
+    if ( ! _phStaIdConverter.hasId(key) )
+        return false;
+
+    const auto it = _obsParamsIdx.find( obsParamsKey(_eventIdConverter.toIdx(evId),
+                                                     _phStaIdConverter.toIdx(key)) );
+    if ( it == _obsParamsIdx.end() )
+        return false;
+
+    obsParamsIdx = it->second;
+    return true;
 }
 
 
@@ -305,10 +756,10 @@ Solver::getEventChanges(unsigned evId, double &deltaLat, double &deltaLon, doubl
 
     unsigned evIdx = _eventIdConverter.toIdx(evId);
 
-    if ( _eventDeltas.find(evIdx) == _eventDeltas.end() )
+    if ( evIdx >= _eventDeltas.size() || ! _eventDeltas[evIdx].relocated )
         return false;
 
-    const EventDeltas& evDelta = _eventDeltas.at(evIdx);
+    const EventDeltas& evDelta = _eventDeltas[evIdx];
     deltaLat = evDelta.deltaLat;
     deltaLon = evDelta.deltaLon;
     deltaDepth = evDelta.deltaDepth;
@@ -325,32 +776,21 @@ Solver::getObservationParamsChanges(unsigned evId, const std::string& staId, cha
                                     double &meanAPrioriWeight,
                                     double &meanFinalWeight) const
 {
-    if ( ! _eventIdConverter.hasId(evId) )
+    unsigned obsParamsIdx;
+    if ( ! findObsParamsIdx(evId, staId, phase, obsParamsIdx) ||
+         obsParamsIdx >= _paramStats.size() )
         return false;
 
-    string phStaId = string(1,phase) + "@" + staId;
-    if ( ! _phStaIdConverter.hasId(phStaId) )
-        return false;
-
-    int evIdx  = _eventIdConverter.toIdx(evId);
-    unsigned phStaIdx = _phStaIdConverter.toIdx(phStaId);
-
-    const auto& it1 = _paramStats.find(evIdx);
-    if ( it1 == _paramStats.end() )
-        return false;
+    const ParamStats& prmSts = _paramStats[obsParamsIdx];
 
-    const auto& it2 = it1->second.find(phStaIdx);
-    if ( it2 == it1->second.end() )
+    // no observation was used to compute the changes of this event
+    if ( (prmSts.startingObservations + prmSts.startingXcorrObservations) == 0 )
         return false;
 
-    const ParamStats& prmSts = it2->second;
-
     startingObservations = prmSts.startingObservations;
     startingXcorrObservations = prmSts.startingXcorrObservations;
     totalFinalObservations    = prmSts.totalFinalObservations;
-    meanAPrioriWeight = 0;
-    if ( (startingObservations + startingXcorrObservations) > 0 )
-        meanAPrioriWeight = prmSts.totalAPrioriWeight / (startingObservations + startingXcorrObservations);
+    meanAPrioriWeight = prmSts.totalAPrioriWeight / (startingObservations + startingXcorrObservations);
     meanFinalWeight = totalFinalObservations ? (prmSts.totalFinalWeight / totalFinalObservations) : 0;
     return true;
 }
@@ -361,7 +801,7 @@ Solver::loadSolutions()
 {
     auto computeEventDelta = [this](unsigned evIdx, EventDeltas& evDelta)
     {
-        const EventParams& evprm = _eventParams.at(evIdx);
+        const EventParams& evprm = _eventParams[evIdx];
         const unsigned evOffset = evIdx * 4;
 
         double deltaX      = _dd->m[evOffset+0];
@@ -390,72 +830,50 @@ Solver::loadSolutions()
     };
 
     //
-    // Compute final weghts for each ObservationParams
+    // Compute final weghts for each ObservationParams and find the events
+    // that have at least one observation whose weight is non zero
+    // (i.e. discard events that lost all their observations due to downweighting )
     // Note: we could have done this even before solving the system
     //       but here is more convenient because we might eventually
     //       add more information depending on the solution
     //
+    _eventDeltas.assign(_dd->nEvts, EventDeltas( {false, 0, 0, 0, 0} ));
+
     for ( unsigned int ob = 0; ob < _dd->nObs; ob++ )
     {
         double observationWeight = _dd->W[ob];
 
         if ( observationWeight == 0. ) continue;
 
-        const unsigned phStaIdx = _dd->phStaByObs[ob]; // station for this observation
-
         const int evIdx1 = _dd->evByObs[ob][0]; // event 1 for this observation
         if ( evIdx1 >= 0 )
         {
-            ParamStats& prmSts = _paramStats.at(evIdx1).at(phStaIdx);
+            ParamStats& prmSts = _paramStats[ _dd->idxGByObs[ob][0] ];
             prmSts.totalFinalObservations++;
             prmSts.totalFinalWeight += observationWeight;
+            _eventDeltas[evIdx1].relocated = true;
         }
 
         const int evIdx2 = _dd->evByObs[ob][1]; // event 2 for this observation
         if ( evIdx2 >= 0 )
         {
-            ParamStats& prmSts = _paramStats.at(evIdx2).at(phStaIdx);
+            ParamStats& prmSts = _paramStats[ _dd->idxGByObs[ob][1] ];
             prmSts.totalFinalObservations++;
             prmSts.totalFinalWeight += observationWeight;
+            _eventDeltas[evIdx2].relocated = true;
         }
     }
 
-    //
-    // Now build a map of events that have at least one observation whose weight is non zero
-    // (i.e. discard events that lost all their observations due to downweighting )
-    //
-    for ( const auto& kv1 : _paramStats )
-    {
-        unsigned evIdx = kv1.first;
-        bool allZero = true;
-
-        for ( const auto& kv2 : kv1.second )
-        {
-            const ParamStats& pweight = kv2.second;
-            if ( pweight.totalFinalWeight > 0 )
-            {
-                allZero = false;
-                break;
-            }
-        }
-
-        if ( ! allZero ) _eventDeltas[evIdx] = { 0 };
-    }
-
     //
     // Load change in event parameters for all events that have at least
     // one non-zero-weight observation
     //
-    for ( auto& kw : _eventDeltas )
+    for ( unsigned evIdx = 0; evIdx < _eventDeltas.size(); evIdx++ )
     {
-        const unsigned evIds = kw.first;
-        EventDeltas& evDelta = kw.second;
-        computeEventDelta( evIds, evDelta );
+        EventDeltas& evDelta = _eventDeltas[evIdx];
+        if ( evDelta.relocated )
+            computeEventDelta( evIdx, evDelta );
     }
-
-    // free some memory
-    _eventParams.clear();
-    _dd = nullptr;
 }
 
 
@@ -472,11 +890,11 @@ Solver::computePartialDerivatives()
     // the new system
     //
     _centroid = {0,0,0};
-    for ( const auto& kw: _eventParams )
+    for ( const EventParams& evprm : _eventParams )
     {
-        _centroid.lat   += kw.second.lat;
-        _centroid.lon   += kw.second.lon;
-        _centroid.depth += kw.second.depth;
+        _centroid.lat   += evprm.lat;
+        _centroid.lon   += evprm.lon;
+        _centroid.depth += evprm.depth;
     }
     _centroid.lat   /= _eventParams.size();
     _centroid.lon   /= _eventParams.size();
@@ -494,47 +912,101 @@ Solver::computePartialDerivatives()
     };
 
     //
-    // convert events coordinates
+    // convert events and stations coordinates
     //
-    for ( auto& kv : _eventParams )
+    auto eventKernel = [this, &convertCoord](unsigned begin, unsigned end)
     {
-        EventParams& evprm = kv.second;
-        convertCoord(evprm.lat, evprm.lon, evprm.depth, evprm.x,  evprm.y, evprm.z);
-    }
+        for ( unsigned evIdx = begin; evIdx < end; evIdx++ )
+        {
+            EventParams& evprm = _eventParams[evIdx];
+            convertCoord(evprm.lat, evprm.lon, evprm.depth, evprm.x,  evprm.y, evprm.z);
+        }
+    };
+    parallelFor(_eventParams.size(), _numThreads, MinCoordsPerThread, eventKernel);
 
-    // convert stations coordinates
-    for ( auto& kv : _stationParams )
+    auto stationKernel = [this, &convertCoord](unsigned begin, unsigned end)
     {
-        StationParams& staprm = kv.second;
-        convertCoord(staprm.lat, staprm.lon, -staprm.elevation/1000., staprm.x,  staprm.y, staprm.z);
-    }
+        for ( unsigned phStaIdx = begin; phStaIdx < end; phStaIdx++ )
+        {
+            StationParams& staprm = _stationParams[phStaIdx];
+            convertCoord(staprm.lat, staprm.lon, -staprm.elevation/1000., staprm.x,  staprm.y, staprm.z);
+        }
+    };
+    parallelFor(_stationParams.size(), _numThreads, MinCoordsPerThread, stationKernel);
 
     //
-    // compute derivatives
+    // compute derivatives: the event to station geometry is derived from the
+    // cartesian coordinates, so there is no spherical computation for each
+    // event/station pair. The angles are never computed explicitly, their
+    // sine and cosine are ratios of the coordinates differences
     //
-    for ( auto& kv1 : _obsParams )
+    auto derivativesKernel = [this](unsigned begin, unsigned end)
     {
-        unsigned evIdx = kv1.first;
-
-        for ( auto& kv2 : kv1.second )
+        for ( unsigned obsPrmIdx = begin; obsPrmIdx < end; obsPrmIdx++ )
         {
-            unsigned phStaIdx = kv2.first;
-            ObservationParams& obsprm = kv2.second;
-            const EventParams& evprm = _eventParams.at(evIdx);
-            const StationParams& staprm = _stationParams.at(phStaIdx);
-
-            double distance = computeDistance(evprm.lat, evprm.lon, evprm.depth,
-                                               staprm.lat, staprm.lon, -staprm.elevation/1000.);
-
-            double angle   = std::atan2( evprm.y - staprm.y, evprm.x - staprm.x);
-            double takeOff = std::atan2( evprm.z - staprm.z, evprm.x - staprm.x);
+            ObservationParams& obsprm = _obsParams[obsPrmIdx];
+            const EventParams& evprm = _eventParams[obsprm.evIdx];
+            const StationParams& staprm = _stationParams[obsprm.phStaIdx];
+
+            const double diffX = evprm.x - staprm.x;
+            const double diffY = evprm.y - staprm.y;
+            const double diffZ = evprm.z - staprm.z;
+            const double hdist = std::sqrt(diffX * diffX + diffY * diffY);
+            const double distance = std::sqrt(hdist * hdist + diffZ * diffZ);
+            const double xzdist = std::sqrt(diffX * diffX + diffZ * diffZ);
+
+            // angle = atan2(diffY, diffX)  takeOff = atan2(diffZ, diffX)
+            const double cosAngle = hdist > 0 ? diffX / hdist : 1.;
+            const double sinAngle = hdist > 0 ? diffY / hdist : 0.;
+            const double sinTakeOff = xzdist > 0 ? diffZ / xzdist : 0.;
 
             obsprm.slowness = obsprm.travelTime / distance;
-            obsprm.dx = obsprm.slowness * std::cos(angle);
-            obsprm.dy = obsprm.slowness * std::sin(angle);
-            obsprm.dz = obsprm.slowness * std::sin(takeOff);
+            obsprm.dx = obsprm.slowness * cosAngle;
+            obsprm.dy = obsprm.slowness * sinAngle;
+            obsprm.dz = obsprm.slowness * sinTakeOff;
         }
+    };
+    parallelFor(_obsParams.size(), _numThreads, MinObsParamsPerThread, derivativesKernel);
+
+    if ( _validatePartialDerivatives )
+    {
+        validatePartialDerivatives();
+    }
+}
+
+
+/*
+ * Compare the partial derivatives with the ones computed using the spherical
+ * distance between each event and station (the original method)
+ */
+void
+Solver::validatePartialDerivatives() const
+{
+    double maxSlownessDiff = 0, maxDerivativeDiff = 0;
+    for ( const ObservationParams& obsprm : _obsParams )
+    {
+        const EventParams& evprm = _eventParams[obsprm.evIdx];
+        const StationParams& staprm = _stationParams[obsprm.phStaIdx];
+
+        double distance = computeDistance(evprm.lat, evprm.lon, evprm.depth,
+                                           staprm.lat, staprm.lon, -staprm.elevation/1000.);
+
+        double angle   = std::atan2( evprm.y - staprm.y, evprm.x - staprm.x);
+        double takeOff = std::atan2( evprm.z - staprm.z, evprm.x - staprm.x);
+
+        double slowness = obsprm.travelTime / distance;
+        double dx = slowness * std::cos(angle);
+        double dy = slowness * std::sin(angle);
+        double dz = slowness * std::sin(takeOff);
+
+        maxSlownessDiff = std::max(maxSlownessDiff, std::abs(slowness - obsprm.slowness) / slowness);
+        maxDerivativeDiff = std::max({maxDerivativeDiff, std::abs(dx - obsprm.dx),
+                                      std::abs(dy - obsprm.dy), std::abs(dz - obsprm.dz)});
     }
+
+    SEISCOMP_INFO("Solver: partial derivatives validation against spherical distances: "
+                  "max relative slowness difference %.3e max derivative difference %.3e [sec/km]",
+                  maxSlownessDiff, maxDerivativeDiff);
 }
 
 vector<double>
@@ -574,48 +1046,131 @@ Solver::computeResidualWeights(vector<double> residuals, const double alpha)
 }
 
 
+void
+Solver::removeDuplicatedObservations()
+{
+    //
+    // The same observation (event pair, station and phase) might have been
+    // added multiple times: only the last one added is used, but it keeps the
+    // position of the first one
+    //
+    auto key = [this](unsigned obIdx)
+    {
+        const Observation& obsrv = _observations[obIdx];
+        return std::make_tuple(obsrv.ev1Idx, obsrv.ev2Idx, obsrv.phStaIdx);
+    };
+
+    vector<unsigned> order(_observations.size());
+    std::iota(order.begin(), order.end(), 0);
+    std::stable_sort(order.begin(), order.end(),
+                     [&key](unsigned a, unsigned b) { return key(a) < key(b); });
+
+    vector<bool> duplicated(_observations.size(), false);
+    bool found = false;
+    for ( unsigned first = 0, last = 0; first < order.size(); first = last + 1 )
+    {
+        last = first;
+        while ( last + 1 < order.size() && key(order[last + 1]) == key(order[first]) )
+            last++;
+
+        if ( last != first )
+        {
+            _observations[order[first]] = _observations[order[last]];
+            for ( unsigned i = first + 1; i <= last; i++ )
+                duplicated[order[i]] = true;
+            found = true;
+        }
+    }
+
+    if ( found )
+    {
+        unsigned newSize = 0;
+        for ( unsigned obIdx = 0; obIdx < _observations.size(); obIdx++ )
+        {
+            if ( ! duplicated[obIdx] )
+                _observations[newSize++] = _observations[obIdx];
+        }
+        _observations.resize(newSize);
+    }
+}
+
+
 void
 Solver::prepareDDSystem(array<double,4> meanShiftConstraint, double residualDownWeight)
 {
-    computePartialDerivatives();
+    //
+    // Build the system structure, unless it is still valid from a previous solve
+    //
+    const bool rebuilt = ! _dd;
+    if ( rebuilt )
+    {
+        removeDuplicatedObservations();
+
+        _dd = DDSystemPtr(new DDSystem(_observations.size(),  _eventIdConverter.size(),
+                                       _phStaIdConverter.size(), _obsParams.size()) );
+
+        // initialize: evByObs, phStaByObs, idxGByObs
+        for ( unsigned obIdx = 0; obIdx < _observations.size(); obIdx++ )
+        {
+            const Observation& obsrv = _observations[obIdx];
 
-    _dd = DDSystemPtr(new DDSystem(_observations.size(),  _eventIdConverter.size(), _phStaIdConverter.size()) );
+            const auto it1 = _obsParamsIdx.find( obsParamsKey(obsrv.ev1Idx, obsrv.phStaIdx) );
+            const auto it2 = _obsParamsIdx.find( obsParamsKey(obsrv.ev2Idx, obsrv.phStaIdx) );
+            if ( it1 == _obsParamsIdx.end() || it2 == _obsParamsIdx.end() )
+            {
+                unsigned evIdx = it1 == _obsParamsIdx.end() ? obsrv.ev1Idx : obsrv.ev2Idx;
+                _dd = nullptr;
+                string msg = stringify("Solver: missing observation parameters for event %u",
+                                       _eventIdConverter.fromIdx(evIdx));
+                throw runtime_error(msg.c_str());
+            }
+
+            _dd->evByObs[obIdx][0] = obsrv.computeEv1Changes ? obsrv.ev1Idx : -1;
+            _dd->evByObs[obIdx][1] = obsrv.computeEv2Changes ? obsrv.ev2Idx : -1;
+            _dd->phStaByObs[obIdx] = obsrv.phStaIdx;
+            _dd->idxGByObs[obIdx][0] = it1->second;
+            _dd->idxGByObs[obIdx][1] = it2->second;
+        }
+    }
+
+    _eventTimeShifts.resize(_dd->nEvts, 0.);
+
+    computePartialDerivatives();
 
     // Init m and L2NScaler
     std::fill_n(_dd->m, _dd->numColsG, 0);
     std::fill_n(_dd->L2NScaler, _dd->numColsG, 1.);
 
-    // initialize G
-    for ( const auto& kv1 : _obsParams )
+    // initialize G: one row for each event/station pair
+    for ( unsigned idxG = 0; idxG < _obsParams.size(); idxG++ )
     {
-        unsigned evIdx = kv1.first;
-        for ( const auto& kv2 : kv1.second )
-        {
-            unsigned phStaIdx = kv2.first;
-            const ObservationParams& obsprm = kv2.second;
-            _dd->G[evIdx * _dd->nPhStas + phStaIdx][0] = obsprm.dx;
-            _dd->G[evIdx * _dd->nPhStas + phStaIdx][1] = obsprm.dy;
-            _dd->G[evIdx * _dd->nPhStas + phStaIdx][2] = obsprm.dz;
-            _dd->G[evIdx * _dd->nPhStas + phStaIdx][3] = 1.; // travel time
-        }
+        const ObservationParams& obsprm = _obsParams[idxG];
+        _dd->G[idxG][0] = obsprm.dx;
+        _dd->G[idxG][1] = obsprm.dy;
+        _dd->G[idxG][2] = obsprm.dz;
+        _dd->G[idxG][3] = 1.; // travel time
     }
 
-    // initialize: W, d, evByObsi, phStaByObs
+    _paramStats.assign(_obsParams.size(), ParamStats());
+
+    // initialize: W, d
     // note: m is zero initialized
-    for ( auto& kw: _observations )
+    for ( unsigned obIdx = 0; obIdx < _observations.size(); obIdx++ )
     {
-        unsigned obIdx = kw.first;
-        Observation& obsrv = kw.second;
+        const Observation& obsrv = _observations[obIdx];
+        const unsigned obsPrmIdx1 = _dd->idxGByObs[obIdx][0];
+        const unsigned obsPrmIdx2 = _dd->idxGByObs[obIdx][1];
 
         _dd->W[obIdx] = obsrv.aPrioriWeight;
-        _dd->evByObs[obIdx][0] = obsrv.computeEv1Changes ? obsrv.ev1Idx : -1;
-        _dd->evByObs[obIdx][1] = obsrv.computeEv2Changes ? obsrv.ev2Idx : -1;
-        _dd->phStaByObs[obIdx] = obsrv.phStaIdx;
+
+        // the observed travel times change when the events origin times are shifted
+        const double observedDiffTime = obsrv.observedDiffTime
+                                      - _eventTimeShifts[obsrv.ev1Idx]
+                                      + _eventTimeShifts[obsrv.ev2Idx];
 
         // compute double difference
-        const ObservationParams& obsprm1 = _obsParams.at(obsrv.ev1Idx).at(obsrv.phStaIdx);
-        const ObservationParams& obsprm2 = _obsParams.at(obsrv.ev2Idx).at(obsrv.phStaIdx); 
-        _dd->d[obIdx] = obsrv.observedDiffTime - (obsprm1.travelTime - obsprm2.travelTime);
+        _dd->d[obIdx] = observedDiffTime -
+                        (_obsParams[obsPrmIdx1].travelTime - _obsParams[obsPrmIdx2].travelTime);
 
         // apply weights to d
         _dd->d[obIdx] *= _dd->W[obIdx];
@@ -623,7 +1178,7 @@ Solver::prepareDDSystem(array<double,4> meanShiftConstraint, double residualDown
         // keep track of the wights for these obsparms
         if ( obsrv.computeEv1Changes )
         {
-            ParamStats& prmSts = _paramStats[obsrv.ev1Idx][obsrv.phStaIdx];
+            ParamStats& prmSts = _paramStats[obsPrmIdx1];
             if ( obsrv.isXcorr ) prmSts.startingXcorrObservations++;
             else prmSts.startingObservations++;
             prmSts.totalAPrioriWeight += _dd->W[obIdx];
@@ -631,7 +1186,7 @@ Solver::prepareDDSystem(array<double,4> meanShiftConstraint, double residualDown
 
         if ( obsrv.computeEv2Changes )
         {
-            ParamStats& prmSts = _paramStats[obsrv.ev2Idx][obsrv.phStaIdx];
+            ParamStats& prmSts = _paramStats[obsPrmIdx2];
             if ( obsrv.isXcorr ) prmSts.startingXcorrObservations++;
             else prmSts.startingObservations++;
             prmSts.totalAPrioriWeight += _dd->W[obIdx]; 
@@ -649,10 +1204,11 @@ Solver::prepareDDSystem(array<double,4> meanShiftConstraint, double residualDown
     _dd->W[_dd->nObs+3] = meanShiftConstraint[3];
 
     // downweight observations by residuals
+    vector<double> resWeights(_dd->nObs, 1.);
     if ( residualDownWeight > 0 )
     {
         vector<double> residuals(_dd->d, _dd->d+_dd->nObs);
-        vector<double> resWeights = computeResidualWeights(residuals, residualDownWeight);
+        resWeights = computeResidualWeights(residuals, residualDownWeight);
         for ( unsigned obIdx = 0; obIdx < _dd->nObs; obIdx++ )
         {
             _dd->W[obIdx] *= resWeights[obIdx];
@@ -660,10 +1216,167 @@ Solver::prepareDDSystem(array<double,4> meanShiftConstraint, double residualDown
         }
     }
 
-    // free some memory 
-    _observations.clear();
-    _obsParams.clear();
-    _stationParams.clear();
+    //
+    // Convergence statistics: weighted residuals RMS and how many residual
+    // weights changed since the previous solve (the observations are the same
+    // only if the system has not been rebuilt)
+    //
+    double sumSquares = 0;
+    unsigned numWeighted = 0;
+    for ( unsigned obIdx = 0; obIdx < _dd->nObs; obIdx++ )
+    {
+        if ( _dd->W[obIdx] == 0. ) continue;
+        sumSquares += _dd->d[obIdx] * _dd->d[obIdx];
+        numWeighted++;
+    }
+    _weightedResidualRMS = numWeighted ? std::sqrt(sumSquares / numWeighted) : 0;
+
+    if ( ! rebuilt && _residualWeights.size() == resWeights.size() )
+    {
+        unsigned changed = 0;
+        for ( unsigned obIdx = 0; obIdx < resWeights.size(); obIdx++ )
+        {
+            if ( std::abs(resWeights[obIdx] - _residualWeights[obIdx]) > WeightChangeTolerance )
+                changed++;
+        }
+        _changedWeightsFraction = resWeights.empty() ? 0 : double(changed) / resWeights.size();
+    }
+    else
+        _changedWeightsFraction = 1.;
+    _residualWeights = std::move(resWeights);
+}
+
+
+/*
+ * Return the index of the only event whose parameters have to be computed,
+ * or -1 if there are more events (or none)
+ */
+int
+Solver::findSingleEventToRelocate(const DDSystem& dd)
+{
+    int evIdx = -1;
+    for ( unsigned int ob = 0; ob < dd.nObs; ob++ )
+    {
+        if ( dd.W[ob] == 0. )
+            continue;
+
+        for ( unsigned side = 0; side < 2; side++ )
+        {
+            const int obEvIdx = dd.evByObs[ob][side];
+            if ( obEvIdx < 0 )
+                continue;
+            if ( evIdx >= 0 && evIdx != obEvIdx )
+                return -1;
+            evIdx = obEvIdx;
+        }
+    }
+    return evIdx;
+}
+
+
+/*
+ * When there is a single event to relocate the system has only 4 unknowns and
+ * the least squares problem solved by LSMR/LSQR:
+ *
+ *     min || A*y - d ||^2 + damp^2 * || y ||^2    with A = W*G*L2NScaler
+ *
+ * can be solved directly via the 4x4 normal equations:
+ *
+ *     (A'*A + damp^2 * I) * y = A'*d
+ *
+ * The other events have no observations, so they are not part of the mean
+ * shift equations (see Adapter::hasObservations), which only constrain the
+ * event itself
+ *
+ * Returns false, without touching dd.m, if the normal equations are singular
+ * or badly conditioned (e.g. few stations and no damping): the iterative
+ * solvers handle those returning the minimum norm solution
+ */
+bool
+Solver::solveSingleEvent(DDSystem& dd, unsigned evIdx, double dampingFactor)
+{
+    const unsigned evOffset = evIdx * 4;
+    const double *scaler = &dd.L2NScaler[evOffset];
+    const double damp2 = dampingFactor * dampingFactor;
+
+    double N[4][4] = { {0} }; // lower triangle of A'*A
+    double b[4] = {0};        // A'*d
+
+    for ( unsigned int ob = 0; ob < dd.nObs; ob++ )
+    {
+        const double obsW = dd.W[ob];
+        if ( obsW == 0. )
+            continue;
+
+        for ( unsigned side = 0; side < 2; side++ )
+        {
+            if ( dd.evByObs[ob][side] != int(evIdx) )
+                continue;
+
+            // event 1 has positive derivatives, event 2 negative ones
+            const double sign = side == 0 ? 1. : -1.;
+            const unsigned idxG = dd.idxGByObs[ob][side];
+            double a[4];
+            for ( unsigned k = 0; k < 4; k++ )
+                a[k] = sign * obsW * dd.G[idxG][k] * scaler[k];
+
+            for ( unsigned r = 0; r < 4; r++ )
+            {
+                b[r] += a[r] * dd.d[ob];
+                for ( unsigned c = 0; c <= r; c++ )
+                    N[r][c] += a[r] * a[c];
+            }
+        }
+    }
+
+    const double *meanShiftWeight = &dd.W[dd.nObs];
+    for ( unsigned k = 0; k < 4; k++ )
+    {
+        N[k][k] += std::pow(meanShiftWeight[k] * scaler[k], 2) + damp2;
+    }
+
+    //
+    // Cholesky decomposition N = L*L' and then solve L*z = b and L'*y = z
+    //
+    double L[4][4] = { {0} };
+    for ( unsigned r = 0; r < 4; r++ )
+    {
+        for ( unsigned c = 0; c <= r; c++ )
+        {
+            double sum = N[r][c];
+            for ( unsigned p = 0; p < c; p++ )
+                sum -= L[r][p] * L[c][p];
+
+            if ( r == c )
+            {
+                if ( ! (sum > N[r][r] * std::numeric_limits<double>::epsilon()) )
+                    return false;
+                L[r][r] = std::sqrt(sum);
+            }
+            else
+                L[r][c] = sum / L[c][c];
+        }
+    }
+
+    double z[4];
+    for ( unsigned r = 0; r < 4; r++ )
+    {
+        z[r] = b[r];
+        for ( unsigned p = 0; p < r; p++ )
+            z[r] -= L[r][p] * z[p];
+        z[r] /= L[r][r];
+    }
+
+    // the other events don't change (they are fixed)
+    std::fill_n(dd.m, dd.numColsG, 0);
+    for ( int r = 3; r >= 0; r-- )
+    {
+        double y = z[r];
+        for ( unsigned p = r + 1; p < 4; p++ )
+            y -= L[p][r] * dd.m[evOffset+p];
+        dd.m[evOffset+r] = y / L[r][r];
+    }
+    return true;
 }
 
 
@@ -675,7 +1388,8 @@ Solver::solve(unsigned numIterations,
               double meanLatShiftConstraint,
               double meanDepthShiftConstraint,
               double meanTTShiftConstraint,
-              bool normalizeG)
+              bool normalizeG,
+              bool blockJacobiPrecond)
 {
     if ( _observations.size() == 0 )
     {
@@ -692,12 +1406,12 @@ Solver::solve(unsigned numIterations,
     if ( _type == "LSQR" )
     {
         _solve<lsqrBase>(numIterations, dampingFactor, residualDownWeight,
-                         meanShiftConstraint, normalizeG);
+                         meanShiftConstraint, normalizeG, blockJacobiPrecond);
     }
     else if ( _type == "LSMR" )
     {
         _solve<lsmrBase>(numIterations, dampingFactor, residualDownWeight,
-                         meanShiftConstraint, normalizeG);
+                         meanShiftConstraint, normalizeG, blockJacobiPrecond);
     }
     else
     {
@@ -711,41 +1425,132 @@ void Solver::_solve(unsigned numIterations,
                     double dampingFactor,
                     double residualDownWeight,
                     array<double,4> meanShiftConstraint,
-                    bool normalizeG)
+                    bool normalizeG,
+                    bool blockJacobiPrecond)
 {
+    _solveStats = SolveStats();
+    auto start = std::chrono::steady_clock::now();
+
     prepareDDSystem(meanShiftConstraint, residualDownWeight);
 
-    Adapter<T> solver;
-    solver.setDDSytem(_dd);
+    const vector<vector<unsigned>> clusters = findEventClusters();
+
+    _solveStats.numObservations = _dd->nObs;
+    _solveStats.numEvents = _dd->nEvts;
+    _solveStats.numClusters = clusters.size();
+    _solveStats.prepareTime = secondsSince(start);
+
+    if ( clusters.size() > 1 )
+    {
+        solveEventClusters<T>(clusters, numIterations, dampingFactor,
+                              normalizeG, blockJacobiPrecond);
+    }
+    else
+    {
+        try {
+            solveDDSystem<T>(_dd, numIterations, dampingFactor, normalizeG,
+                             blockJacobiPrecond, _numThreads, true, _solveStats);
+        } catch ( ... ) {
+            _dd = nullptr;
+            throw;
+        }
+        start = std::chrono::steady_clock::now();
+        loadSolutions();
+        _solveStats.loadTime = secondsSince(start);
+    }
+
+    if ( std::none_of(_eventDeltas.begin(), _eventDeltas.end(),
+                      [](const EventDeltas& evDelta) { return evDelta.relocated; }) )
+    {
+        throw runtime_error("Solver: no event has been relocated");
+    } 
+}
+
+
+/*
+ * Solve dd and store the solution in dd->m. The time spent normalizing and
+ * solving the system and the number of solver iterations (0 when the system
+ * is solved directly) are added to stats
+ */
+template <class T>
+void Solver::solveDDSystem(const DDSystemPtr& dd,
+                           unsigned numIterations,
+                           double dampingFactor,
+                           bool normalizeG,
+                           bool blockJacobiPrecond,
+                           unsigned numThreads,
+                           bool verbose,
+                           SolveStats& stats) const
+{
+    unsigned iterations = 0;
+    auto start = std::chrono::steady_clock::now();
+
+    Adapter<T> solver(numThreads);
+    solver.setDDSytem(dd);
     if ( normalizeG )
     {
         solver.L2normalize();
     }
 
-    solver.SetDamp(dampingFactor);
-    solver.SetMaximumNumberOfIterations(numIterations ? numIterations : _dd->numColsG/2);
+    bool solvedDirectly = false;
+    const int singleEvIdx = findSingleEventToRelocate(*dd);
+    if ( singleEvIdx >= 0 )
+    {
+        stats.normalizeTime += secondsSince(start);
+        start = std::chrono::steady_clock::now();
+        // e.g. real-time relocation with fixed neighbours: no need for an
+        // iterative solver, unless the normal equations are ill-conditioned
+        solvedDirectly = solveSingleEvent(*dd, singleEvIdx, dampingFactor);
+        if ( verbose )
+            SEISCOMP_INFO(solvedDirectly ?
+                "Single event to relocate: solved the normal equations directly" :
+                "Single event to relocate: the normal equations are ill-conditioned, "
+                "use the iterative solver");
+    }
 
-    const double eps = 1e-15;
-    solver.SetEpsilon( eps );
-    solver.SetToleranceA( 1e-16 );
-    solver.SetToleranceB( 1e-16 );
-    solver.SetUpperLimitOnConditional( 1.0 / ( 10 * sqrt( eps ) ) );
+    if ( ! solvedDirectly )
+    {
+        if ( blockJacobiPrecond )
+        {
+            solver.blockJacobiPrecondition();
+        }
+        stats.normalizeTime += secondsSince(start);
+        start = std::chrono::steady_clock::now();
+        solver.prepare();
 
-    //std::ostringstream solverLogs;
-    //solver.SetOutputStream( solverLogs );
+        solver.SetDamp(dampingFactor);
+        solver.SetMaximumNumberOfIterations(numIterations ? numIterations : dd->numColsG/2);
 
-    solver.Solve(_dd->numRowsG, _dd->numColsG, _dd->d, _dd->m );
+        const double eps = 1e-15;
+        solver.SetEpsilon( eps );
+        solver.SetToleranceA( 1e-16 );
+        solver.SetToleranceB( 1e-16 );
+        solver.SetUpperLimitOnConditional( 1.0 / ( 10 * sqrt( eps ) ) );
 
-    //SEISCOMP_DEBUG("%s", solverLogs.str().c_str() );
+        //std::ostringstream solverLogs;
+        //solver.SetOutputStream( solverLogs );
 
-    SEISCOMP_INFO("Stopped because %u : %s", solver.GetStoppingReason(), solver.GetStoppingReasonMessage().c_str());
-    SEISCOMP_INFO("Used %u Iterations", solver.GetNumberOfIterationsPerformed());
+        solver.Solve(dd->numRowsG, dd->numColsG, dd->d, dd->m );
 
-    if ( solver.GetStoppingReason() == 4 )
-    {
-        _dd = nullptr;
-        string msg = stringify("Solver: no solution found (%s)", solver.GetStoppingReasonMessage().c_str() );
-        throw runtime_error(msg.c_str());
+        //SEISCOMP_DEBUG("%s", solverLogs.str().c_str() );
+
+        iterations = solver.GetNumberOfIterationsPerformed();
+        if ( verbose )
+        {
+            SEISCOMP_INFO("Stopped because %u : %s", solver.GetStoppingReason(), solver.GetStoppingReasonMessage().c_str());
+            SEISCOMP_INFO("Used %u Iterations", iterations);
+        }
+
+        if ( solver.GetStoppingReason() == 4 )
+        {
+            string msg = stringify("Solver: no solution found (%s)", solver.GetStoppingReasonMessage().c_str() );
+            throw runtime_error(msg.c_str());
+        }
+
+        if ( blockJacobiPrecond )
+        {
+            solver.blockJacobiDePrecondition();
+        }
     }
 
     if ( normalizeG )
@@ -753,12 +1558,262 @@ void Solver::_solve(unsigned numIterations,
         solver.L2DeNormalize();
     }
 
+    stats.solverTime += secondsSince(start);
+    stats.iterations = std::max(stats.iterations, iterations);
+}
+
+
+/*
+ * Partition the events whose parameters have to be computed in clusters:
+ * the connected components of the graph whose nodes are the events and whose
+ * edges are the non-zero weight observations. Events without such
+ * observations don't belong to any cluster.
+ * The clusters are sorted by their first event and each cluster contains
+ * its events in ascending order
+ */
+vector<vector<unsigned>>
+Solver::findEventClusters() const
+{
+    // union-find: the root of each set is its smallest event
+    vector<unsigned> parent(_dd->nEvts);
+    std::iota(parent.begin(), parent.end(), 0);
+    auto root = [&parent](unsigned evIdx)
+    {
+        while ( parent[evIdx] != evIdx )
+        {
+            parent[evIdx] = parent[ parent[evIdx] ];
+            evIdx = parent[evIdx];
+        }
+        return evIdx;
+    };
+
+    vector<bool> hasObs(_dd->nEvts, false);
+    for ( unsigned int ob = 0; ob < _dd->nObs; ob++ )
+    {
+        if ( _dd->W[ob] == 0. ) continue;
+
+        const int evIdx1 = _dd->evByObs[ob][0];
+        const int evIdx2 = _dd->evByObs[ob][1];
+        if ( evIdx1 >= 0 ) hasObs[evIdx1] = true;
+        if ( evIdx2 >= 0 ) hasObs[evIdx2] = true;
+        if ( evIdx1 >= 0 && evIdx2 >= 0 )
+        {
+            const unsigned root1 = root(evIdx1);
+            const unsigned root2 = root(evIdx2);
+            if ( root1 < root2 ) parent[root2] = root1;
+            else if ( root2 < root1 ) parent[root1] = root2;
+        }
+    }
+
+    vector<vector<unsigned>> clusters;
+    vector<int> clusterByRoot(_dd->nEvts, -1);
+    for ( unsigned evIdx = 0; evIdx < _dd->nEvts; evIdx++ )
+    {
+        if ( ! hasObs[evIdx] ) continue;
+
+        const unsigned evRoot = root(evIdx);
+        if ( clusterByRoot[evRoot] < 0 )
+        {
+            clusterByRoot[evRoot] = clusters.size();
+            clusters.emplace_back();
+        }
+        clusters[ clusterByRoot[evRoot] ].push_back(evIdx);
+    }
+    return clusters;
+}
+
+
+/*
+ * Extract from _dd the system of a single cluster: its events, the
+ * non-zero weight observations clusterObs involving them, the G rows used by
+ * those observations and the mean shift constraints.
+ * localEvIdx and localIdxG are scratch buffers of size nEvts and nObsParams
+ * initialized to -1, which are restored to -1 before returning
+ */
+DDSystemPtr
+Solver::buildClusterDDSystem(const vector<unsigned>& cluster,
+                             const vector<unsigned>& clusterObs,
+                             vector<int>& localEvIdx,
+                             vector<int>& localIdxG) const
+{
+    for ( unsigned i = 0; i < cluster.size(); i++ )
+        localEvIdx[ cluster[i] ] = i;
+
+    vector<unsigned> idxGs; // local G row -> _dd G row
+    for ( unsigned ob : clusterObs )
+    {
+        for ( unsigned side = 0; side < 2; side++ )
+        {
+            const unsigned idxG = _dd->idxGByObs[ob][side];
+            if ( localIdxG[idxG] < 0 )
+            {
+                localIdxG[idxG] = idxGs.size();
+                idxGs.push_back(idxG);
+            }
+        }
+    }
+
+    DDSystemPtr dd = DDSystemPtr(new DDSystem(clusterObs.size(), cluster.size(),
+                                              _dd->nPhStas, idxGs.size()));
+
+    for ( unsigned localObIdx = 0; localObIdx < clusterObs.size(); localObIdx++ )
+    {
+        const unsigned ob = clusterObs[localObIdx];
+        dd->W[localObIdx] = _dd->W[ob];
+        dd->d[localObIdx] = _dd->d[ob];
+        dd->phStaByObs[localObIdx] = _dd->phStaByObs[ob];
+        for ( unsigned side = 0; side < 2; side++ )
+        {
+            const int evIdx = _dd->evByObs[ob][side];
+            dd->evByObs[localObIdx][side] = evIdx >= 0 ? localEvIdx[evIdx] : -1;
+            dd->idxGByObs[localObIdx][side] = localIdxG[ _dd->idxGByObs[ob][side] ];
+        }
+    }
+
+    for ( unsigned localIdx = 0; localIdx < idxGs.size(); localIdx++ )
+    {
+        std::copy_n(_dd->G[ idxGs[localIdx] ], 4, dd->G[localIdx]);
+        localIdxG[ idxGs[localIdx] ] = -1;
+    }
+
+    // mean shift constraints of this cluster
+    std::copy_n(&_dd->W[_dd->nObs], 4, &dd->W[dd->nObs]);
+    std::copy_n(&_dd->d[_dd->nObs], 4, &dd->d[dd->nObs]);
+
+    std::fill_n(dd->m, dd->numColsG, 0);
+    std::fill_n(dd->L2NScaler, dd->numColsG, 1.);
+
+    for ( unsigned evIdx : cluster )
+        localEvIdx[evIdx] = -1;
+
+    return dd;
+}
+
+
+/*
+ * Solve each cluster of events as an independent system. The clusters
+ * large enough to benefit from the parallel solver kernels are solved one
+ * after another using all the threads, while the others are solved
+ * concurrently, one cluster per thread.
+ * The events of a cluster that cannot be solved are not relocated
+ */
+template <class T>
+void Solver::solveEventClusters(const vector<vector<unsigned>>& clusters,
+                                unsigned numIterations,
+                                double dampingFactor,
+                                bool normalizeG,
+                                bool blockJacobiPrecond)
+{
+    //
+    // Build the system of each cluster
+    //
+    vector<int> clusterByEv(_dd->nEvts, -1);
+    for ( unsigned c = 0; c < clusters.size(); c++ )
+        for ( unsigned evIdx : clusters[c] )
+            clusterByEv[evIdx] = c;
+
+    vector<vector<unsigned>> clusterObs(clusters.size());
+    for ( unsigned int ob = 0; ob < _dd->nObs; ob++ )
+    {
+        if ( _dd->W[ob] == 0. ) continue;
+        // both events of an observation belong to the same cluster
+        const int evIdx = _dd->evByObs[ob][0] >= 0 ? _dd->evByObs[ob][0] : _dd->evByObs[ob][1];
+        if ( evIdx >= 0 )
+            clusterObs[ clusterByEv[evIdx] ].push_back(ob);
+    }
+
+    auto start = std::chrono::steady_clock::now();
+
+    vector<DDSystemPtr> systems(clusters.size());
+    vector<int> localEvIdx(_dd->nEvts, -1);
+    vector<int> localIdxG(_dd->nObsParams, -1);
+    for ( unsigned c = 0; c < clusters.size(); c++ )
+    {
+        systems[c] = buildClusterDDSystem(clusters[c], clusterObs[c], localEvIdx, localIdxG);
+        clusterObs[c] = vector<unsigned>();
+    }
+    _solveStats.prepareTime += secondsSince(start);
+
+    //
+    // Solve the clusters
+    //
+    vector<SolveStats> clusterStats(clusters.size());
+    vector<string> errors(clusters.size());
+    vector<char> failed(clusters.size(), false);
+
+    auto solveCluster = [&](unsigned c, unsigned numThreads)
+    {
+        try {
+            solveDDSystem<T>(systems[c], numIterations, dampingFactor, normalizeG,
+                             blockJacobiPrecond, numThreads, false, clusterStats[c]);
+        } catch ( exception& e ) {
+            errors[c] = e.what();
+            failed[c] = true;
+        }
+    };
+
+    vector<unsigned> smallClusters;
+    for ( unsigned c = 0; c < clusters.size(); c++ )
+    {
+        if ( _numThreads != 1 && systems[c]->nObs >= 2 * Adapter<T>::MinObsPerThread )
+            solveCluster(c, _numThreads);
+        else
+            smallClusters.push_back(c);
+    }
+
+    unsigned numWorkers = _numThreads ? _numThreads : std::max(std::thread::hardware_concurrency(), 1u);
+    numWorkers = std::min<unsigned>(numWorkers, smallClusters.size());
+    std::atomic<unsigned> nextCluster(0);
+    auto worker = [&](unsigned workerBegin, unsigned workerEnd)
+    {
+        for ( unsigned w = workerBegin; w < workerEnd; w++ )
+        {
+            unsigned i;
+            while ( (i = nextCluster++) < smallClusters.size() )
+                solveCluster(smallClusters[i], 1);
+        }
+    };
+    Seiscomp::HDD::parallelFor(numWorkers, numWorkers, 1, worker);
+
+    //
+    // Collect the solutions
+    //
+    std::fill_n(_dd->m, _dd->numColsG, 0);
+    unsigned largestCluster = 0, maxIterations = 0, failedClusters = 0;
+    for ( unsigned c = 0; c < clusters.size(); c++ )
+    {
+        largestCluster = std::max<unsigned>(largestCluster, clusters[c].size());
+        maxIterations = std::max(maxIterations, clusterStats[c].iterations);
+        // the clusters solved concurrently add up
+        _solveStats.normalizeTime += clusterStats[c].normalizeTime;
+        _solveStats.solverTime += clusterStats[c].solverTime;
+        if ( failed[c] )
+        {
+            SEISCOMP_INFO("Solver: cannot solve cluster of %lu events starting with event %u (%s)",
+                          clusters[c].size(), _eventIdConverter.fromIdx(clusters[c][0]),
+                          errors[c].c_str());
+            failedClusters++;
+            continue;
+        }
+        for ( unsigned i = 0; i < clusters[c].size(); i++ )
+            std::copy_n(&systems[c]->m[i*4], 4, &_dd->m[ clusters[c][i] * 4 ]);
+    }
+
+    SEISCOMP_INFO("Solver: solved %lu independent clusters of events (largest %u events, "
+                  "max %u iterations, %u failed)", clusters.size(), largestCluster,
+                  maxIterations, failedClusters);
+    _solveStats.iterations = maxIterations;
+
+    start = std::chrono::steady_clock::now();
     loadSolutions();
+    _solveStats.loadTime = secondsSince(start);
 
-    if ( _eventDeltas.empty() )
+    for ( unsigned c = 0; c < clusters.size(); c++ )
     {
-        throw runtime_error("Solver: no event has been relocated");
-    } 
+        if ( failed[c] )
+            for ( unsigned evIdx : clusters[c] )
+                _eventDeltas[evIdx].relocated = false;
+    }
 }
 
 
@@ -24,6 +24,7 @@
 #include <seiscomp3/core/baseobject.h>
 #include <unordered_map>
 #include <vector>
+#include <cstdint>
 
 namespace Seiscomp {
 namespace HDD {
@@ -45,7 +46,9 @@ namespace HDD {
  * This class also contains 4 additional equations for constraining the mean
  * shift of all earthquakes during relocation.
  *
- * We take advantage of the sparsness of G matrix, so G is not a full matrix
+ * We take advantage of the sparsness of G matrix, so G is not a full matrix:
+ * only the event/station pairs that appear in the observations are stored and
+ * each observation references its 2 rows of G via idxGByObs
  */
 struct DDSystem : public Core::BaseObject {
 
@@ -55,9 +58,11 @@ struct DDSystem : public Core::BaseObject {
     const unsigned nEvts;
     // number of stations
     const unsigned nPhStas;
+    // number of event/station pairs used by the observations
+    const unsigned nObsParams;
     // W[nObs+4]: weight of each observation + cluster mean shift constraints (x,y,z,time) 
     double *W;
-    // G[nEvts*nPhStas][4]: 3 partial derivatives for each event/station pair + tt (dx,dy,dz,1)
+    // G[nObsParams][4]: 3 partial derivatives for each event/station pair + tt (dx,dy,dz,1)
     double (*G)[4];
     // m[nEvts*4]: changes for each event hypocentral parameters we wish to determine (x,y,z,t)
     double (*m);
@@ -69,24 +74,29 @@ struct DDSystem : public Core::BaseObject {
     int (*evByObs)[2];
     // phStaByObs[nObs]: map of station idx for each observation
     unsigned *phStaByObs;
+    // idxGByObs[nObs][2]: map of the 2 G rows (event/station pairs) for each observation
+    unsigned (*idxGByObs)[2];
 
     const unsigned numRowsG;
     const unsigned numColsG;
 
-    DDSystem(unsigned _nObs, unsigned _nEvts, unsigned _nPhStas)
-        : nObs(_nObs), nEvts(_nEvts), nPhStas(_nPhStas), numRowsG(nObs+4), numColsG(nEvts*4)
+    DDSystem(unsigned _nObs, unsigned _nEvts, unsigned _nPhStas, unsigned _nObsParams)
+        : nObs(_nObs), nEvts(_nEvts), nPhStas(_nPhStas), nObsParams(_nObsParams),
+          numRowsG(nObs+4), numColsG(nEvts*4)
     {
         W = new double[numRowsG];
-        G = new double[nEvts*nPhStas][4];
+        G = new double[nObsParams][4];
         m = new double[numColsG];
         d = new double[numRowsG];
         L2NScaler = new double[numColsG];
         evByObs = new int[nObs][2];
         phStaByObs = new unsigned[nObs];
+        idxGByObs = new unsigned[nObs][2];
     }
 
     virtual ~DDSystem()
     {
+        delete[] idxGByObs;
         delete[] phStaByObs;
         delete[] evByObs;
         delete[] L2NScaler;
@@ -107,15 +117,43 @@ DEFINE_SMARTPOINTER(DDSystem);
  * Solver for double difference problems.
  *
  * For details see Waldhauser & Ellsworth 2000 paper
+ *
+ * The system can be solved multiple times: the observations and the
+ * DDSystem structure are kept between calls to solve() and only the values
+ * (travel times, locations, origin times, weights) are recomputed. This allows
+ * iterative relocations to update the events that moved (addObservationParams
+ * on existing event/station pairs and shiftEventOriginTime) instead of
+ * rebuilding the whole system. Adding new observations or new event/station
+ * pairs forces the DDSystem to be rebuilt at the next solve()
+ *
+ * When the observations split the events in independent clusters (connected
+ * components of the graph whose nodes are the events and whose edges are the
+ * observations) each cluster is solved as a separate smaller system, with
+ * its own mean shift constraints, and the clusters are solved concurrently
  */
 class Solver : public Core::BaseObject
 {
 
 public:
-    Solver(std::string type) : _type(type) {}
+    /*
+     * numThreads: threads used by the solver kernels (0 = all available cores)
+     */
+    Solver(std::string type, unsigned numThreads = 1)
+        : _type(type), _numThreads(numThreads) {}
     virtual ~Solver() {}
 
-    void reset() { *this = Solver(_type); }
+    void reset()
+    {
+        const bool validate = _validatePartialDerivatives;
+        *this = Solver(_type, _numThreads);
+        _validatePartialDerivatives = validate;
+    }
+
+    /*
+     * Log, at each solve, the difference between the partial derivatives and
+     * the ones computed with spherical event to station distances (slow)
+     */
+    void setValidatePartialDerivatives(bool validate) { _validatePartialDerivatives = validate; }
 
     void addObservation(unsigned evId1, unsigned evId2, const std::string& staId, char phase,
                         double diffTime, double aPrioriWeight,
@@ -126,6 +164,12 @@ public:
                               double staLat, double staLon, double staElevation,
                               double travelTime);
 
+    /*
+     * The origin time of an already added event has been shifted by timeShift
+     * seconds, which changes the observed travel times of all its observations
+     */
+    void shiftEventOriginTime(unsigned evId, double timeShift);
+
     void solve(unsigned numIterations=0,
                double dampingFactor=0,
                double residualDownWeight=0,
@@ -133,11 +177,41 @@ public:
                double meanLatShiftConstraint=0,
                double meanDepthShiftConstraint=0,
                double meanTTShiftConstraint=0,
-               bool normalizeG=true);
+               bool normalizeG=true,
+               bool blockJacobiPrecond=false);
 
     bool getEventChanges(unsigned evId, double &deltaLat, double &deltaLon,
                          double &deltaDepth, double &deltaTT) const;
 
+    /*
+     * Weighted RMS of the double-difference residuals at the start of the last
+     * solve() (i.e. the misfit of the current event parameters)
+     */
+    double getWeightedResidualRMS() const { return _weightedResidualRMS; }
+
+    /*
+     * Fraction of observations whose residual weight changed in the last
+     * solve() compared to the previous one (1 when the observations changed)
+     */
+    double getChangedWeightsFraction() const { return _changedWeightsFraction; }
+
+    /*
+     * Size of the last solved system and time spent in each phase of solve()
+     * in seconds. When the events form independent clusters, the time of the
+     * clusters solved concurrently is summed up
+     */
+    struct SolveStats {
+        unsigned numObservations = 0;
+        unsigned numEvents = 0;
+        unsigned numClusters = 0;
+        unsigned iterations = 0;   // solver iterations (max over the clusters)
+        double prepareTime = 0;    // build the system, partial derivatives, weights
+        double normalizeTime = 0;  // L2 normalization and preconditioning
+        double solverTime = 0;     // solver iterations
+        double loadTime = 0;       // event changes from the solutions
+    };
+    const SolveStats& getSolveStats() const { return _solveStats; }
+
     bool getObservationParamsChanges(unsigned evId, const std::string& staId, char phase,
                                      unsigned &startingObservations, 
                                      unsigned &startingXcorrObservations,
@@ -149,17 +223,48 @@ private:
 
     void computePartialDerivatives();
 
+    void validatePartialDerivatives() const;
+
     std::vector<double> computeResidualWeights(std::vector<double> residuals, const double alpha);
 
+    void removeDuplicatedObservations();
+
     void prepareDDSystem(std::array<double,4> meanShiftConstraint, double residualDownWeight);
 
     template <class T>
     void _solve(unsigned numIterations, double dampingFactor,
                 double residualDownWeight, std::array<double,4> meanShiftConstraint,
-                bool normalizeG);
+                bool normalizeG, bool blockJacobiPrecond);
+
+    template <class T>
+    void solveDDSystem(const DDSystemPtr& dd, unsigned numIterations,
+                       double dampingFactor, bool normalizeG,
+                       bool blockJacobiPrecond, unsigned numThreads,
+                       bool verbose, SolveStats& stats) const;
+
+    template <class T>
+    void solveEventClusters(const std::vector<std::vector<unsigned>>& clusters,
+                            unsigned numIterations, double dampingFactor,
+                            bool normalizeG, bool blockJacobiPrecond);
+
+    std::vector<std::vector<unsigned>> findEventClusters() const;
+
+    DDSystemPtr buildClusterDDSystem(const std::vector<unsigned>& cluster,
+                                     const std::vector<unsigned>& clusterObs,
+                                     std::vector<int>& localEvIdx,
+                                     std::vector<int>& localIdxG) const;
+
+    static int findSingleEventToRelocate(const DDSystem& dd);
+
+    static bool solveSingleEvent(DDSystem& dd, unsigned evIdx, double dampingFactor);
 
     void loadSolutions();
 
+    unsigned convertPhStaId(const std::string& staId, char phase);
+
+    bool findObsParamsIdx(unsigned evId, const std::string& staId, char phase,
+                          unsigned& obsParamsIdx) const;
+
 private:
 
     /*
@@ -173,31 +278,30 @@ private:
       public:
         unsigned convert(const T& id)
         {
-            if ( _to.find(id) == _to.end() )
-            {
-                unsigned newIdx = _currentIdx++;
-                _to[id] = newIdx;
-                _from[newIdx] = id;
-            }
-            return _to.at(id);
+            const auto it = _to.find(id);
+            if ( it != _to.end() )
+                return it->second;
+            unsigned newIdx = _from.size();
+            _to.emplace(id, newIdx);
+            _from.push_back(id);
+            return newIdx;
         }
 
         unsigned toIdx(const T& id) const { return _to.at(id); }
         T fromIdx(unsigned idx) const { return _from.at(idx); }
 
-        bool hasIdx(unsigned idx) const { return _from.find(idx) != _from.end(); } 
+        bool hasIdx(unsigned idx) const { return idx < _from.size(); } 
         bool hasId(const T& id) const { return _to.find(id) != _to.end(); } 
 
-        unsigned size() { return _to.size(); }
+        unsigned size() const { return _from.size(); }
 
       private:
-        unsigned _currentIdx = 0;
         std::unordered_map<T,unsigned> _to;
-        std::unordered_map<unsigned,T> _from;
+        std::vector<T> _from;
     };
     IdToIndex<unsigned> _eventIdConverter;
-    IdToIndex<std::string> _phStaIdConverter;
-    IdToIndex<std::string> _obsIdConverter;
+    IdToIndex<std::string> _staIdConverter;
+    IdToIndex<uint64_t> _phStaIdConverter; // key = staIdx << 8 | phase
 
     struct Observation {
         unsigned ev1Idx;
@@ -209,29 +313,34 @@ private:
         double aPrioriWeight;
         bool isXcorr;
     };
-    std::unordered_map<unsigned,Observation> _observations; // key = obsIdx
+    std::vector<Observation> _observations; // index = obsIdx
 
     struct EventParams {
         double lat, lon, depth;
         double x, y, z; // km
     };
-    std::unordered_map<unsigned,EventParams> _eventParams; // key = evIdx
+    std::vector<EventParams> _eventParams; // index = evIdx
+    std::vector<double> _eventTimeShifts; // index = evIdx
 
     struct StationParams {
         double lat, lon, elevation;
         double x, y, z; // km
     };
-    std::unordered_map<unsigned,StationParams> _stationParams;  // key = phStaIdx
+    std::vector<StationParams> _stationParams;  // index = phStaIdx
 
     struct ObservationParams {
+        unsigned evIdx;
+        unsigned phStaIdx;
         double travelTime;
         double slowness;
         double dx;
         double dy;
         double dz;
     };
-    // key1=evIdx  key2=phStaIdx
-    std::unordered_map<unsigned, std::unordered_map<unsigned,ObservationParams>> _obsParams;
+    // index = obsParamsIdx, which is also the row in DDSystem G
+    std::vector<ObservationParams> _obsParams;
+    // key = obsParamsKey(evIdx, phStaIdx)  value = obsParamsIdx
+    std::unordered_map<uint64_t,unsigned> _obsParamsIdx;
 
     struct ParamStats {
         unsigned startingObservations = 0;
@@ -240,20 +349,27 @@ private:
         double totalAPrioriWeight = 0;
         double totalFinalWeight = 0;
     };
-    // key1=evIdx  key2=phStaIdx
-    std::unordered_map<unsigned, std::unordered_map<unsigned,ParamStats>> _paramStats;
+    std::vector<ParamStats> _paramStats; // index = obsParamsIdx
 
     struct {
         double lat, lon, depth;
     } _centroid;
 
     struct EventDeltas {
+        bool relocated;
         double deltaLat, deltaLon, deltaDepth, deltaTT;
     };
-    std::unordered_map<unsigned,EventDeltas> _eventDeltas; // key = evIdx
+    std::vector<EventDeltas> _eventDeltas; // index = evIdx
+
+    std::vector<double> _residualWeights; // index = obsIdx
+    double _weightedResidualRMS = 0;
+    double _changedWeightsFraction = 1.;
+    SolveStats _solveStats;
 
     DDSystemPtr _dd;
     std::string _type;
+    unsigned _numThreads;
+    bool _validatePartialDerivatives = false;
 };
 
 DEFINE_SMARTPOINTER(Solver);
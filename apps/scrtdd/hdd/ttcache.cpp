@@ -0,0 +1,201 @@
+/***************************************************************************
+ *   Copyright (C) by ETHZ/SED                                             *
+ *                                                                         *
+ * This program is free software: you can redistribute it and/or modify    *
+ * it under the terms of the GNU Affero General Public License as published*
+ * by the Free Software Foundation, either version 3 of the License, or    *
+ * (at your option) any later version.                                     *
+ *                                                                         *
+ * This program is distributed in the hope that it will be useful,         *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of          *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           *
+ * GNU Affero General Public License for more details.                     *
+ *                                                                         *
+ *                                                                         *
+ *   Developed by Luca Scarabello <luca.scarabello@sed.ethz.ch>            *
+ ***************************************************************************/
+
+#include "ttcache.h"
+
+#include <seiscomp3/math/geo.h>
+#include <cstring>
+#include <cmath>
+
+using namespace std;
+using Event = Seiscomp::HDD::Catalog::Event;
+using Station = Seiscomp::HDD::Catalog::Station;
+
+namespace {
+
+uint64_t doubleBits(double value)
+{
+    uint64_t bits;
+    std::memcpy(&bits, &value, sizeof(bits));
+    return bits;
+}
+
+}
+
+namespace Seiscomp {
+namespace HDD {
+
+
+TravelTimeCache::TravelTimeCache(const string& type, const string& model,
+                                 double gridSpacing, unsigned maxEntries)
+    : _gridSpacing(gridSpacing), _degStep(Math::Geo::km2deg(gridSpacing)),
+      _maxEntries(maxEntries)
+{
+    _ttt = TravelTimeTableInterface::Create(type.c_str());
+    if ( ! _ttt )
+    {
+        throw runtime_error("Unable to create travel time table " + type);
+    }
+    _ttt->setModel(model.c_str());
+}
+
+
+size_t
+TravelTimeCache::KeyHasher::operator()(const Key& key) const
+{
+    size_t seed = std::hash<unsigned>()(key.staIdx) ^ (size_t(uint8_t(key.phaseType)) << 24);
+    for ( uint64_t pos : key.pos )
+        seed ^= std::hash<uint64_t>()(pos) + 0x9e3779b9 + (seed << 6) + (seed >> 2);
+    return seed;
+}
+
+
+void
+TravelTimeCache::clear()
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    _entries.clear();
+    _staIdx.clear();
+    _staLocations.clear();
+    _hits = _misses = _gridHits = 0;
+}
+
+
+TravelTimeCache::Stats
+TravelTimeCache::stats() const
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    return Stats( {_entries.size(), _hits, _misses, _gridHits} );
+}
+
+
+/*
+ * Return the cached travel time for key, computing it at lat, lon, depth
+ * if missing. _mutex must be held by the caller
+ */
+double
+TravelTimeCache::lookup(const Key& key, const Station& station,
+                        double lat, double lon, double depth)
+{
+    const auto it = _entries.find(key);
+    if ( it != _entries.end() )
+    {
+        _hits++;
+        return it->second;
+    }
+
+    _misses++;
+    TravelTime tt = _ttt->compute(string(1, key.phaseType).c_str(), lat, lon, depth,
+                                  station.latitude, station.longitude, station.elevation);
+
+    if ( _entries.size() >= _maxEntries )
+    {
+        _entries.clear();
+    }
+    _entries.emplace(key, tt.time);
+    return tt.time;
+}
+
+
+/*
+ * _mutex must be held by the caller
+ */
+unsigned
+TravelTimeCache::stationIndex(const Station& station)
+{
+    const std::array<double,3> location( {{station.latitude, station.longitude,
+                                            station.elevation}} );
+
+    auto it = _staIdx.find(station.id);
+    if ( it != _staIdx.end() && _staLocations[it->second] == location )
+        return it->second;
+
+    const unsigned staIdx = _staLocations.size();
+    _staLocations.push_back(location);
+    _staIdx[station.id] = staIdx;
+    return staIdx;
+}
+
+
+double
+TravelTimeCache::compute(const Event& event, const Station& station, char phaseType)
+{
+    double travelTime;
+    if ( _grid && _grid->compute(station, phaseType, event.latitude, event.longitude,
+                                 event.depth, travelTime) )
+    {
+        _gridHits++;
+        return travelTime;
+    }
+
+    std::lock_guard<std::mutex> lock(_mutex);
+
+    const unsigned staIdx = stationIndex(station);
+
+    if ( _gridSpacing <= 0 )
+    {
+        const Key key( {staIdx, phaseType, {doubleBits(event.latitude),
+                        doubleBits(event.longitude), doubleBits(event.depth)}} );
+        return lookup(key, station, event.latitude, event.longitude, event.depth);
+    }
+
+    //
+    // Trilinear interpolation between the 8 grid nodes around the event
+    //
+    const double pos[3] = { event.latitude / _degStep, event.longitude / _degStep,
+                            event.depth / _gridSpacing };
+    int64_t node[3];
+    double frac[3];
+    for ( unsigned i = 0; i < 3; i++ )
+    {
+        node[i] = int64_t(std::floor(pos[i]));
+        frac[i] = pos[i] - node[i];
+    }
+
+    try {
+        travelTime = 0;
+        for ( unsigned corner = 0; corner < 8; corner++ )
+        {
+            Key key( {staIdx, phaseType, {0, 0, 0}} );
+            double weight = 1;
+            for ( unsigned i = 0; i < 3; i++ )
+            {
+                const unsigned offset = (corner >> i) & 1;
+                key.pos[i] = uint64_t(node[i] + offset);
+                weight *= offset ? frac[i] : 1 - frac[i];
+            }
+            if ( weight == 0 )
+                continue;
+            travelTime += weight * lookup(key, station,
+                                          int64_t(key.pos[0]) * _degStep,
+                                          int64_t(key.pos[1]) * _degStep,
+                                          int64_t(key.pos[2]) * _gridSpacing);
+        }
+        return travelTime;
+    } catch ( ... ) {
+        // a grid node might be outside the table (e.g. above the surface):
+        // compute the travel time at the exact position instead
+        TravelTime tt = _ttt->compute(string(1, phaseType).c_str(),
+                                      event.latitude, event.longitude, event.depth,
+                                      station.latitude, station.longitude, station.elevation);
+        return tt.time;
+    }
+}
+
+
+}
+}
@@ -0,0 +1,121 @@
+/***************************************************************************
+ *   Copyright (C) by ETHZ/SED                                             *
+ *                                                                         *
+ * This program is free software: you can redistribute it and/or modify    *
+ * it under the terms of the GNU Affero General Public License as published*
+ * by the Free Software Foundation, either version 3 of the License, or    *
+ * (at your option) any later version.                                     *
+ *                                                                         *
+ * This program is distributed in the hope that it will be useful,         *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of          *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           *
+ * GNU Affero General Public License for more details.                     *
+ *                                                                         *
+ *                                                                         *
+ *   Developed by Luca Scarabello <luca.scarabello@sed.ethz.ch>            *
+ ***************************************************************************/ 
+
+#ifndef __RTDD_APPLICATIONS_TTCACHE_H__
+#define __RTDD_APPLICATIONS_TTCACHE_H__
+
+#include "catalog.h"
+#include "ttgrid.h"
+#include <seiscomp3/core/baseobject.h>
+#include <seiscomp3/seismology/ttt.h>
+#include <unordered_map>
+#include <mutex>
+#include <array>
+#include <vector>
+#include <atomic>
+#include <cstdint>
+
+
+namespace Seiscomp {
+namespace HDD {
+
+/*
+ * Memoize the travel times computed by a TravelTimeTableInterface, so that the
+ * same travel time is not computed again across solver iterations and
+ * relocations (e.g. the neighbouring events in real-time relocations)
+ *
+ * The entries are keyed by station, phase and source position. When
+ * gridSpacing is 0 the source position must match exactly. Otherwise the
+ * travel times are computed on the nodes of a latitude/longitude/depth grid
+ * (gridSpacing in km, converted to degrees for latitude and longitude) and the
+ * travel time at the source position is trilinearly interpolated from the 8
+ * surrounding nodes. This trades some accuracy for many more cache hits when
+ * events move by small amounts.
+ *
+ * When a TravelTimeGrid is set, the travel times are taken from the grid
+ * whenever the station, phase and source position are covered by it, and the
+ * cache is used only for the remaining ones.
+ *
+ * The cache is safe for concurrent use. The calls to the underlying
+ * TravelTimeTableInterface are serialized, because the travel time tables
+ * are not thread safe.
+ */
+class TravelTimeCache : public Core::BaseObject {
+
+    public:
+        TravelTimeCache(const std::string& type, const std::string& model,
+                        double gridSpacing = 0, unsigned maxEntries = 1000000);
+
+        double compute(const Catalog::Event& event, const Catalog::Station& station,
+                       char phaseType);
+
+        void setGrid(const TravelTimeGridPtr& grid) { _grid = grid; }
+
+        void clear();
+
+        struct Stats {
+            unsigned long entries;
+            unsigned long hits;
+            unsigned long misses;
+            unsigned long gridHits;
+        };
+        Stats stats() const;
+
+    private:
+        struct Key {
+            unsigned staIdx;
+            char phaseType;
+            uint64_t pos[3]; // lat,lon,depth: exact value bits or grid node indices
+            bool operator==(const Key& other) const
+            {
+                return staIdx == other.staIdx && phaseType == other.phaseType &&
+                       pos[0] == other.pos[0] && pos[1] == other.pos[1] &&
+                       pos[2] == other.pos[2];
+            }
+        };
+
+        struct KeyHasher {
+            size_t operator()(const Key& key) const;
+        };
+
+        double lookup(const Key& key, const Catalog::Station& station,
+                      double lat, double lon, double depth);
+        unsigned stationIndex(const Catalog::Station& station);
+
+        TravelTimeTableInterfacePtr _ttt;
+        TravelTimeGridPtr _grid;
+        const double _gridSpacing; // km, 0 = exact positions
+        const double _degStep;     // gridSpacing converted to degrees
+        const unsigned _maxEntries;
+
+        mutable std::mutex _mutex;
+        // a station that moves (e.g. catalog reload) gets a new index, so that
+        // the travel times computed for the old location are not used
+        std::unordered_map<std::string, unsigned> _staIdx;
+        std::vector<std::array<double,3>> _staLocations; // lat,lon,elevation by index
+        std::unordered_map<Key, double, KeyHasher> _entries;
+        unsigned long _hits = 0;
+        unsigned long _misses = 0;
+        std::atomic<unsigned long> _gridHits{0};
+};
+
+DEFINE_SMARTPOINTER(TravelTimeCache);
+
+}
+}
+
+#endif
@@ -0,0 +1,366 @@
+/***************************************************************************
+ *   Copyright (C) by ETHZ/SED                                             *
+ *                                                                         *
+ * This program is free software: you can redistribute it and/or modify    *
+ * it under the terms of the GNU Affero General Public License as published*
+ * by the Free Software Foundation, either version 3 of the License, or    *
+ * (at your option) any later version.                                     *
+ *                                                                         *
+ * This program is distributed in the hope that it will be useful,         *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of          *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           *
+ * GNU Affero General Public License for more details.                     *
+ *                                                                         *
+ *                                                                         *
+ *   Developed by Luca Scarabello <luca.scarabello@sed.ethz.ch>            *
+ ***************************************************************************/
+
+#include "ttgrid.h"
+
+#include <seiscomp3/seismology/ttt.h>
+#include <seiscomp3/math/geo.h>
+#include <seiscomp3/math/math.h>
+#include <seiscomp3/core/strings.h>
+#include <stdexcept>
+#include <fstream>
+#include <vector>
+#include <limits>
+#include <cstring>
+#include <cstdio>
+#include <cmath>
+#include <algorithm>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define SEISCOMP_COMPONENT RTDD
+#include <seiscomp3/logging/log.h>
+
+using namespace std;
+using Seiscomp::Core::stringify;
+using Event = Seiscomp::HDD::Catalog::Event;
+using Station = Seiscomp::HDD::Catalog::Station;
+
+namespace {
+
+// longitude in the [-180, 180) range
+double normalizeLon(double lon)
+{
+    return lon - 360. * std::floor((lon + 180.) / 360.);
+}
+
+/*
+ * Smallest longitude interval [minLon, maxLon] containing all the given
+ * longitudes: it might cross the antimeridian, in which case maxLon > 180
+ */
+void coveringLongitudes(vector<double> lons, double& minLon, double& maxLon)
+{
+    for ( double& lon : lons )
+        lon = normalizeLon(lon);
+    std::sort(lons.begin(), lons.end());
+
+    // the interval is what is left after removing the largest gap between
+    // consecutive longitudes, the one across the antimeridian included
+    size_t gapEnd = 0;
+    double maxGap = lons.front() + 360. - lons.back();
+    for ( size_t i = 1; i < lons.size(); i++ )
+    {
+        if ( lons[i] - lons[i-1] > maxGap )
+        {
+            maxGap = lons[i] - lons[i-1];
+            gapEnd = i;
+        }
+    }
+
+    minLon = lons[gapEnd];
+    maxLon = gapEnd == 0 ? lons.back() : lons[gapEnd-1] + 360.;
+}
+
+}
+
+namespace Seiscomp {
+namespace HDD {
+
+
+const char TravelTimeGrid::Magic[8] = {'R','T','D','D','T','T','G','\0'};
+
+
+TravelTimeGrid::TravelTimeGrid(const string& filename)
+{
+    int fd = ::open(filename.c_str(), O_RDONLY);
+    if ( fd < 0 )
+    {
+        string msg = "Unable to open travel time grid file " + filename;
+        throw runtime_error(msg);
+    }
+
+    struct stat st;
+    if ( ::fstat(fd, &st) != 0 || size_t(st.st_size) < sizeof(FileHeader) )
+    {
+        ::close(fd);
+        string msg = "Invalid travel time grid file " + filename;
+        throw runtime_error(msg);
+    }
+
+    _mappingSize = st.st_size;
+    _mapping = ::mmap(nullptr, _mappingSize, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if ( _mapping == MAP_FAILED )
+    {
+        _mapping = nullptr;
+        string msg = "Unable to memory-map travel time grid file " + filename;
+        throw runtime_error(msg);
+    }
+
+    _header = static_cast<const FileHeader*>(_mapping);
+    _tables = reinterpret_cast<const TableHeader*>(_header + 1);
+    _data   = reinterpret_cast<const float*>(_tables + _header->numTables);
+
+    const size_t tableSize = size_t(_header->numLat) * _header->numLon * _header->numDepth;
+    const size_t expectedSize = sizeof(FileHeader) + _header->numTables *
+                                (sizeof(TableHeader) + tableSize * sizeof(float));
+
+    if ( std::memcmp(_header->magic, Magic, sizeof(Magic)) != 0 ||
+         _header->version != Version ||
+         _header->numLat < 2 || _header->numLon < 2 || _header->numDepth < 2 ||
+         _mappingSize != expectedSize )
+    {
+        ::munmap(_mapping, _mappingSize);
+        _mapping = nullptr;
+        string msg = "Invalid travel time grid file " + filename;
+        throw runtime_error(msg);
+    }
+
+    for ( unsigned idx = 0; idx < _header->numTables; idx++ )
+    {
+        const TableHeader& table = _tables[idx];
+        const string stationId(table.stationId, strnlen(table.stationId, sizeof(table.stationId)));
+        auto it = _tableIdx.emplace(stationId, std::make_pair(-1, -1)).first;
+        if ( table.phaseType == 'P' ) it->second.first = idx;
+        else if ( table.phaseType == 'S' ) it->second.second = idx;
+    }
+
+    SEISCOMP_INFO("Loaded travel time grid %s (%u tables, %ux%ux%u nodes)",
+                  filename.c_str(), _header->numTables, _header->numLat,
+                  _header->numLon, _header->numDepth);
+}
+
+
+TravelTimeGrid::~TravelTimeGrid()
+{
+    if ( _mapping )
+        ::munmap(_mapping, _mappingSize);
+}
+
+
+void
+TravelTimeGrid::generate(const string& filename, const string& tttType,
+                         const string& tttModel, const CatalogCPtr& catalog,
+                         double spacing, double margin)
+{
+    if ( spacing <= 0 || margin < 0 )
+    {
+        throw runtime_error("Travel time grid: invalid spacing or margin");
+    }
+
+    if ( catalog->getEvents().empty() )
+    {
+        throw runtime_error("Travel time grid: the catalog has no events");
+    }
+
+    TravelTimeTableInterfacePtr ttt = TravelTimeTableInterface::Create(tttType.c_str());
+    if ( ! ttt )
+    {
+        string msg = "Unable to create travel time table " + tttType;
+        throw runtime_error(msg);
+    }
+    ttt->setModel(tttModel.c_str());
+
+    //
+    // Grid geometry: the area covered by the catalog events plus the margin
+    //
+    double minLat = 90, maxLat = -90, minLon, maxLon;
+    double minDepth = std::numeric_limits<double>::max();
+    double maxDepth = std::numeric_limits<double>::lowest();
+    vector<double> lons;
+    for ( const auto& kv : catalog->getEvents() )
+    {
+        const Event& event = kv.second;
+        minLat = std::min(minLat, event.latitude);
+        maxLat = std::max(maxLat, event.latitude);
+        lons.push_back(event.longitude);
+        minDepth = std::min(minDepth, event.depth);
+        maxDepth = std::max(maxDepth, event.depth);
+    }
+    // the catalog might cross the antimeridian
+    coveringLongitudes(lons, minLon, maxLon);
+
+    const double latStep = Math::Geo::km2deg(spacing);
+    const double lonStep = latStep / std::cos(deg2rad((minLat + maxLat) / 2));
+    const double latMargin = Math::Geo::km2deg(margin);
+    const double lonMargin = latMargin / std::cos(deg2rad((minLat + maxLat) / 2));
+
+    FileHeader header;
+    std::memset(&header, 0, sizeof(header));
+    std::memcpy(header.magic, Magic, sizeof(Magic));
+    header.version   = Version;
+    header.lat0      = minLat - latMargin;
+    header.lon0      = minLon - lonMargin;
+    header.depth0    = std::max(minDepth - margin, 0.);
+    header.latStep   = latStep;
+    header.lonStep   = lonStep;
+    header.depthStep = spacing;
+    header.numLat    = std::max(unsigned(std::ceil((maxLat + latMargin - header.lat0) / latStep)) + 1, 2u);
+    header.numLon    = std::max(unsigned(std::ceil((maxLon + lonMargin - header.lon0) / lonStep)) + 1, 2u);
+    header.numDepth  = std::max(unsigned(std::ceil((maxDepth + margin - header.depth0) / spacing)) + 1, 2u);
+
+    vector<TableHeader> tables;
+    for ( const auto& kv : catalog->getStations() )
+    {
+        const Station& station = kv.second;
+        if ( station.id.size() >= sizeof(TableHeader::stationId) )
+        {
+            SEISCOMP_WARNING("Travel time grid: skipping station %s (id too long)", station.id.c_str());
+            continue;
+        }
+        for ( char phaseType : {'P', 'S'} )
+        {
+            TableHeader table;
+            std::memset(&table, 0, sizeof(table));
+            std::strncpy(table.stationId, station.id.c_str(), sizeof(table.stationId) - 1);
+            table.phaseType = phaseType;
+            table.latitude  = station.latitude;
+            table.longitude = station.longitude;
+            table.elevation = station.elevation;
+            tables.push_back(table);
+        }
+    }
+    header.numTables = tables.size();
+
+    SEISCOMP_INFO("Generating travel time grid %s: %u tables, %ux%ux%u nodes "
+                  "(lat %.4f-%.4f lon %.4f-%.4f depth %.2f-%.2f km)", filename.c_str(),
+                  header.numTables, header.numLat, header.numLon, header.numDepth,
+                  header.lat0, header.lat0 + (header.numLat - 1) * latStep,
+                  header.lon0, header.lon0 + (header.numLon - 1) * lonStep,
+                  header.depth0, header.depth0 + (header.numDepth - 1) * spacing);
+
+    // write to a temporary file first, since the current grid file might be
+    // memory-mapped by a running process
+    const string tmpFilename = filename + ".tmp";
+    ofstream out(tmpFilename, ios::binary | ios::trunc);
+    if ( ! out )
+    {
+        string msg = "Unable to create travel time grid file " + tmpFilename;
+        throw runtime_error(msg);
+    }
+    out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    out.write(reinterpret_cast<const char*>(tables.data()), tables.size() * sizeof(TableHeader));
+
+    vector<float> values(size_t(header.numLat) * header.numLon * header.numDepth);
+    for ( const TableHeader& table : tables )
+    {
+        const char phase[2] = { table.phaseType, '\0' };
+        size_t idx = 0;
+        for ( unsigned i = 0; i < header.numLat; i++ )
+        {
+            for ( unsigned j = 0; j < header.numLon; j++ )
+            {
+                for ( unsigned k = 0; k < header.numDepth; k++ )
+                {
+                    float value;
+                    try {
+                        TravelTime tt = ttt->compute(phase,
+                                                     header.lat0 + i * latStep,
+                                                     normalizeLon(header.lon0 + j * lonStep),
+                                                     header.depth0 + k * spacing,
+                                                     table.latitude, table.longitude,
+                                                     table.elevation);
+                        value = tt.time;
+                    } catch ( ... ) {
+                        value = std::numeric_limits<float>::quiet_NaN();
+                    }
+                    values[idx++] = value;
+                }
+            }
+        }
+        out.write(reinterpret_cast<const char*>(values.data()), values.size() * sizeof(float));
+        SEISCOMP_DEBUG("Travel time grid: station %s phase %c done", table.stationId, table.phaseType);
+    }
+
+    out.close();
+    if ( ! out || std::rename(tmpFilename.c_str(), filename.c_str()) != 0 )
+    {
+        std::remove(tmpFilename.c_str());
+        string msg = "Error while writing travel time grid file " + filename;
+        throw runtime_error(msg);
+    }
+}
+
+
+bool
+TravelTimeGrid::compute(const Station& station, char phaseType,
+                        double lat, double lon, double depth, double& travelTime) const
+{
+    const auto it = _tableIdx.find(station.id);
+    if ( it == _tableIdx.end() )
+        return false;
+
+    const int idx = phaseType == 'P' ? it->second.first :
+                    phaseType == 'S' ? it->second.second : -1;
+    if ( idx < 0 )
+        return false;
+
+    // the grid is valid for the station location it was generated for
+    const TableHeader& table = _tables[idx];
+    if ( table.latitude  != station.latitude  ||
+         table.longitude != station.longitude ||
+         table.elevation != station.elevation )
+        return false;
+
+    // the grid might cross the antimeridian
+    double lonOffset = lon - _header->lon0;
+    lonOffset -= 360. * std::floor(lonOffset / 360.);
+
+    const double pos[3] = { (lat   - _header->lat0)   / _header->latStep,
+                            lonOffset / _header->lonStep,
+                            (depth - _header->depth0) / _header->depthStep };
+    const unsigned size[3] = { _header->numLat, _header->numLon, _header->numDepth };
+
+    unsigned node[3];
+    double frac[3];
+    for ( unsigned i = 0; i < 3; i++ )
+    {
+        if ( ! (pos[i] >= 0 && pos[i] <= size[i] - 1) )
+            return false;
+        node[i] = std::min(unsigned(pos[i]), size[i] - 2);
+        frac[i] = pos[i] - node[i];
+    }
+
+    const float *values = _data + size_t(idx) * size[0] * size[1] * size[2];
+    double value = 0;
+    for ( unsigned corner = 0; corner < 8; corner++ )
+    {
+        double weight = 1;
+        unsigned n[3];
+        for ( unsigned i = 0; i < 3; i++ )
+        {
+            const unsigned offset = (corner >> i) & 1;
+            n[i] = node[i] + offset;
+            weight *= offset ? frac[i] : 1 - frac[i];
+        }
+        if ( weight == 0 )
+            continue;
+        value += weight * values[ (size_t(n[0]) * size[1] + n[1]) * size[2] + n[2] ];
+    }
+
+    if ( std::isnan(value) )
+        return false;
+
+    travelTime = value;
+    return true;
+}
+
+
+}
+}
@@ -0,0 +1,112 @@
+/***************************************************************************
+ *   Copyright (C) by ETHZ/SED                                             *
+ *                                                                         *
+ * This program is free software: you can redistribute it and/or modify    *
+ * it under the terms of the GNU Affero General Public License as published*
+ * by the Free Software Foundation, either version 3 of the License, or    *
+ * (at your option) any later version.                                     *
+ *                                                                         *
+ * This program is distributed in the hope that it will be useful,         *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of          *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           *
+ * GNU Affero General Public License for more details.                     *
+ *                                                                         *
+ *                                                                         *
+ *   Developed by Luca Scarabello <luca.scarabello@sed.ethz.ch>            *
+ ***************************************************************************/ 
+
+#ifndef __RTDD_APPLICATIONS_TTGRID_H__
+#define __RTDD_APPLICATIONS_TTGRID_H__
+
+#include "catalog.h"
+#include <seiscomp3/core/baseobject.h>
+#include <unordered_map>
+#include <string>
+#include <cstdint>
+
+
+namespace Seiscomp {
+namespace HDD {
+
+/*
+ * Precomputed travel times, one 3D grid (latitude, longitude, depth) for each
+ * station and phase, stored in a binary file that is memory-mapped and
+ * queried by trilinear interpolation.
+ *
+ * The grid file is generated once (see generate) from a travel time table
+ * (e.g. LOCSAT) for the stations and the area of a catalog. All the grids in
+ * a file share the same geometry.
+ *
+ * The grid is read-only once loaded, so it is safe for concurrent use.
+ *
+ * File layout (native byte order):
+ *   FileHeader
+ *   TableHeader[numTables]
+ *   float[numTables][numLat][numLon][numDepth]  travel times in seconds (NaN
+ *                                               where the table has no value)
+ */
+class TravelTimeGrid : public Core::BaseObject {
+
+    public:
+        explicit TravelTimeGrid(const std::string& filename);
+        virtual ~TravelTimeGrid();
+
+        /*
+         * Write a grid file for all the stations of the catalog and for P and S
+         * phases, covering the catalog events plus a margin (km). spacing is
+         * the distance between grid nodes in km
+         */
+        static void generate(const std::string& filename, const std::string& tttType,
+                             const std::string& tttModel, const CatalogCPtr& catalog,
+                             double spacing, double margin);
+
+        /*
+         * Return false if the station/phase is not in the grid or the source is
+         * outside the grid, in which case travelTime is not set
+         */
+        bool compute(const Catalog::Station& station, char phaseType,
+                     double lat, double lon, double depth, double& travelTime) const;
+
+        unsigned numTables() const { return _header->numTables; }
+
+    private:
+        struct FileHeader {
+            char magic[8];
+            uint32_t version;
+            uint32_t numTables;
+            double lat0, lon0, depth0; // first node
+            double latStep, lonStep, depthStep; // degrees, degrees, km
+            uint32_t numLat, numLon, numDepth;
+            uint32_t reserved;
+        };
+
+        struct TableHeader {
+            char stationId[64];
+            char phaseType;
+            char reserved[7];
+            double latitude, longitude, elevation; // station
+        };
+
+        static const char Magic[8];
+        static const uint32_t Version = 1;
+
+        TravelTimeGrid(const TravelTimeGrid&) = delete;
+        TravelTimeGrid& operator=(const TravelTimeGrid&) = delete;
+
+        void *_mapping = nullptr;
+        size_t _mappingSize = 0;
+
+        const FileHeader *_header;
+        const TableHeader *_tables;
+        const float *_data;
+
+        // key = station id  value = table index for P and S (-1 if missing)
+        std::unordered_map<std::string, std::pair<int,int>> _tableIdx;
+};
+
+DEFINE_SMARTPOINTER(TravelTimeGrid);
+
+}
+}
+
+#endif
@@ -111,5 +111,77 @@ double computeMeanAbsoluteDeviation(const std::vector<double>& values, const dou
 }
 
 
+ThreadPool::ThreadPool(unsigned numThreads)
+{
+    if ( numThreads == 0 )
+        numThreads = std::max(std::thread::hardware_concurrency(), 1u);
+
+    _workers.reserve(numThreads - 1);
+    for ( unsigned i = 1; i < numThreads; i++ )
+        _workers.emplace_back(&ThreadPool::work, this);
+}
+
+
+ThreadPool::~ThreadPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(_mtx);
+        _stop = true;
+    }
+    _taskCond.notify_all();
+    for ( std::thread& t : _workers )
+        t.join();
+}
+
+
+void ThreadPool::run(unsigned numChunks, const std::function<void(unsigned)>& task)
+{
+    std::unique_lock<std::mutex> lock(_mtx);
+    _task = &task;
+    _numChunks = numChunks;
+    _nextChunk = 0;
+    _pendingChunks = numChunks;
+    _taskCond.notify_all();
+
+    runChunks(lock);
+    _doneCond.wait(lock, [this]() { return _pendingChunks == 0; });
+    _task = nullptr;
+}
+
+
+/*
+ * Execute the chunks of the current loop until there are none left. lock
+ * holds _mtx, which is released while a chunk is executed
+ */
+void ThreadPool::runChunks(std::unique_lock<std::mutex>& lock)
+{
+    while ( _task && _nextChunk < _numChunks )
+    {
+        const unsigned chunk = _nextChunk++;
+        const std::function<void(unsigned)>& task = *_task;
+        lock.unlock();
+        task(chunk);
+        lock.lock();
+        if ( --_pendingChunks == 0 )
+            _doneCond.notify_all();
+    }
+}
+
+
+void ThreadPool::work()
+{
+    std::unique_lock<std::mutex> lock(_mtx);
+    while ( true )
+    {
+        _taskCond.wait(lock, [this]() {
+            return _stop || (_task && _nextChunk < _numChunks);
+        });
+        if ( _stop )
+            return;
+        runChunks(lock);
+    }
+}
+
+
 }
 }
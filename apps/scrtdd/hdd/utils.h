@@ -22,6 +22,11 @@
 #include <seiscomp3/core/strings.h>
 #include <vector>
 #include <random>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <algorithm>
 
 namespace Seiscomp {
 namespace HDD { 
@@ -45,6 +50,101 @@ double computeMean(const std::vector<double>& values);
 
 double computeMeanAbsoluteDeviation(const std::vector<double>& values, const double mean);
 
+/*
+ * Split the range [0,size) in contiguous chunks, one per thread, and call
+ * func(begin, end) for each of them concurrently. numThreads = 0 means one
+ * thread per available core. If the range is too small to give each thread at
+ * least minChunkSize elements, fewer threads are used (down to the calling
+ * thread only). func must not throw and each call must only write data
+ * belonging to its own chunk
+ */
+template <class Func>
+void parallelFor(unsigned size, unsigned numThreads, unsigned minChunkSize, const Func& func)
+{
+    if ( numThreads == 0 )
+        numThreads = std::max(std::thread::hardware_concurrency(), 1u);
+    numThreads = std::min(numThreads, std::max(size / std::max(minChunkSize, 1u), 1u));
+
+    if ( numThreads <= 1 )
+    {
+        func(0, size);
+        return;
+    }
+
+    const unsigned chunkSize = (size + numThreads - 1) / numThreads;
+    std::vector<std::thread> threads;
+    threads.reserve(numThreads - 1);
+    for ( unsigned begin = chunkSize; begin < size; begin += chunkSize )
+    {
+        const unsigned end = std::min(begin + chunkSize, size);
+        threads.emplace_back([&func, begin, end]() { func(begin, end); });
+    }
+    func(0, chunkSize);
+    for ( std::thread& t : threads )
+        t.join();
+}
+
+/*
+ * Threads that live as long as the pool and execute the chunks of its
+ * parallelFor loops. Meant for code running many short loops (e.g. the
+ * solver iterations), where creating the threads at each loop costs as much
+ * as the loop itself. numThreads includes the calling thread, which executes
+ * chunks too, and 0 means one thread per available core. A pool runs one
+ * loop at a time
+ */
+class ThreadPool {
+
+public:
+
+    explicit ThreadPool(unsigned numThreads);
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    unsigned numThreads() const { return _workers.size() + 1; }
+
+    /*
+     * Same as the parallelFor function above, the range is split in the
+     * same chunks, but the pool threads are used
+     */
+    template <class Func>
+    void parallelFor(unsigned size, unsigned minChunkSize, const Func& func)
+    {
+        const unsigned numChunks = std::min(numThreads(),
+                std::max(size / std::max(minChunkSize, 1u), 1u));
+
+        if ( numChunks <= 1 )
+        {
+            func(0, size);
+            return;
+        }
+
+        const unsigned chunkSize = (size + numChunks - 1) / numChunks;
+        run(numChunks, [&func, size, chunkSize](unsigned chunk) {
+            const unsigned begin = chunk * chunkSize;
+            if ( begin < size )
+                func(begin, std::min(begin + chunkSize, size));
+        });
+    }
+
+private:
+
+    void run(unsigned numChunks, const std::function<void(unsigned)>& task);
+    void runChunks(std::unique_lock<std::mutex>& lock);
+    void work();
+
+    std::vector<std::thread> _workers;
+    std::mutex _mtx;
+    std::condition_variable _taskCond;
+    std::condition_variable _doneCond;
+    const std::function<void(unsigned)> *_task = nullptr;
+    unsigned _numChunks = 0;
+    unsigned _nextChunk = 0;
+    unsigned _pendingChunks = 0;
+    bool _stop = false;
+};
+
 
 class Randomer {
 
@@ -242,6 +242,9 @@ RTDD::Config::Config()
     allowManualOrigin = false;
     profileTimeAlive = -1;
     cacheWaveforms = false;
+    threads = 1;
+    neighboursCacheSize = 50;
+    neighboursCacheTolerance = 0;
     cacheAllWaveforms = false;
     debugWaveforms = false;
 
@@ -288,12 +291,17 @@ RTDD::RTDD(int argc, char **argv) : Application(argc, argv)
 
     NEW_OPT(_config.profileTimeAlive, "performance.profileTimeAlive");
     NEW_OPT(_config.cacheWaveforms, "performance.cacheWaveforms");
+    NEW_OPT(_config.threads, "performance.threads");
+    NEW_OPT(_config.neighboursCacheSize, "performance.neighboursCacheSize");
+    NEW_OPT(_config.neighboursCacheTolerance, "performance.neighboursCacheTolerance");
 
     NEW_OPT_CLI(_config.loadProfile, "Mode", "load-profile-wf",
                 "Load catalog waveforms from the configured recordstream and save them into the profile working directory", true);
     NEW_OPT_CLI(_config.dumpWaveforms, "Mode", "debug-wf", "Enable the saving of processed waveforms (filtered/resampled, SNR rejected, ZRT projected, etc) into the profile working directory", false, true);
     NEW_OPT_CLI(_config.evalXCorr, "Mode", "eval-xcorr",
                 "Evaluate cross-correlation settings for the given profile", true);
+    NEW_OPT_CLI(_config.generateTTTGrid, "Mode", "gen-ttt-grid",
+                "Generate the travel time grid file (travelTimeTable.gridFile) for the profile passed as argument", true);
     NEW_OPT_CLI(_config.fExpiry, "Mode", "expiry,x",
                 "Time span in hours after which objects expire", true);
 
@@ -346,6 +354,7 @@ bool RTDD::validateParameters()
          !_config.dumpCatalogXML.empty()  ||
          !_config.loadProfile.empty()     ||
          !_config.evalXCorr.empty()       ||
+         !_config.generateTTTGrid.empty() ||
          !_config.relocateProfile.empty() ||
          (!_config.originIDs.empty() && _config.testMode)
        )
@@ -357,6 +366,18 @@ bool RTDD::validateParameters()
 
     _config.workingDirectory = env->absolutePath(configGetPath("workingDirectory"));
 
+    if ( _config.threads < 0 )
+    {
+        SEISCOMP_ERROR("performance.threads: invalid value %d", _config.threads);
+        return false;
+    }
+
+    if ( _config.neighboursCacheSize < 0 || _config.neighboursCacheTolerance < 0 )
+    {
+        SEISCOMP_ERROR("performance.neighboursCacheSize/neighboursCacheTolerance: invalid value");
+        return false;
+    }
+
     bool profilesOK = true;
 
     for ( vector<string>::iterator it = _config.activeProfiles.begin();
@@ -367,6 +388,9 @@ bool RTDD::validateParameters()
         string prefix = string("profile.") + *it + ".";
 
         prof->name = *it;
+        prof->ddcfg.numThreads = _config.threads;
+        prof->ddcfg.neighboursCache.maxEntries = _config.neighboursCacheSize;
+        prof->ddcfg.neighboursCache.locationTolerance = _config.neighboursCacheTolerance;
 
         try {
             prof->earthModelID = configGetString(prefix + "earthModelID");
@@ -581,12 +605,30 @@ bool RTDD::validateParameters()
         try {
             prof->ddcfg.ttt.model = configGetString(prefix + "travelTimeTable.tableModel");
         } catch ( ... ) { prof->ddcfg.ttt.model = "iasp91"; } 
+        try {
+            prof->ddcfg.ttt.cacheGridSpacing = configGetDouble(prefix + "travelTimeTable.cacheGridSpacing");
+        } catch ( ... ) { prof->ddcfg.ttt.cacheGridSpacing = 0; }
+        try {
+            prof->ddcfg.ttt.gridFile = env->absolutePath(configGetPath(prefix + "travelTimeTable.gridFile"));
+        } catch ( ... ) { prof->ddcfg.ttt.gridFile = ""; }
+        try {
+            prof->ddcfg.ttt.gridSpacing = configGetDouble(prefix + "travelTimeTable.gridSpacing");
+        } catch ( ... ) { prof->ddcfg.ttt.gridSpacing = 1.0; }
+        try {
+            prof->ddcfg.ttt.gridMargin = configGetDouble(prefix + "travelTimeTable.gridMargin");
+        } catch ( ... ) { prof->ddcfg.ttt.gridMargin = 10.0; }
         try {
             prof->ddcfg.solver.type = configGetString(prefix + "solverType");
         } catch ( ... ) { prof->ddcfg.solver.type = "LSMR"; }
         try {
             prof->ddcfg.solver.algoIterations = configGetInt(prefix + "algoIterations");
         } catch ( ... ) { prof->ddcfg.solver.algoIterations = 20; } 
+        try {
+            prof->ddcfg.solver.blockJacobiPreconditioning = configGetBool(prefix + "blockJacobiPreconditioning");
+        } catch ( ... ) { prof->ddcfg.solver.blockJacobiPreconditioning = false; }
+        try {
+            prof->ddcfg.solver.validatePartialDerivatives = configGetBool(prefix + "validatePartialDerivatives");
+        } catch ( ... ) { prof->ddcfg.solver.validatePartialDerivatives = false; }
         try {
             prof->ddcfg.solver.dampingFactorStart = configGetDouble(prefix + "dampingFactor.startingValue");
         } catch ( ... ) { prof->ddcfg.solver.dampingFactorStart = 0.; } 
@@ -615,6 +657,21 @@ bool RTDD::validateParameters()
         try {
             prof->ddcfg.solver.downWeightingByResidualEnd = configGetDouble(prefix + "downWeightingByResidual.finalValue");
         } catch ( ... ) { prof->ddcfg.solver.downWeightingByResidualEnd = 3.; } 
+        try {
+            prof->ddcfg.solver.convergence.enable = configGetBool(prefix + "convergence.enable");
+        } catch ( ... ) { prof->ddcfg.solver.convergence.enable = false; }
+        try {
+            prof->ddcfg.solver.convergence.maxShift = configGetDouble(prefix + "convergence.maxShift");
+        } catch ( ... ) { prof->ddcfg.solver.convergence.maxShift = 0.05; }
+        try {
+            prof->ddcfg.solver.convergence.rmsShift = configGetDouble(prefix + "convergence.rmsShift");
+        } catch ( ... ) { prof->ddcfg.solver.convergence.rmsShift = 0.01; }
+        try {
+            prof->ddcfg.solver.convergence.residualRMSChange = configGetDouble(prefix + "convergence.residualRMSChange");
+        } catch ( ... ) { prof->ddcfg.solver.convergence.residualRMSChange = 0.01; }
+        try {
+            prof->ddcfg.solver.convergence.changedWeightsFraction = configGetDouble(prefix + "convergence.changedWeightsFraction");
+        } catch ( ... ) { prof->ddcfg.solver.convergence.changedWeightsFraction = 0.02; }
         try {
             prof->ddcfg.solver.usePickUncertainty = configGetBool(prefix + "aPrioriWeights.usePickUncertainties");
         } catch ( ... ) { prof->ddcfg.solver.usePickUncertainty = false; }
@@ -734,6 +791,28 @@ bool RTDD::run()
         return true;
     }
 
+    // generate the travel time grid and exit
+    if ( !_config.generateTTTGrid.empty() )
+    {
+        for ( ProfilePtr profile : _profiles )
+        {
+            if ( profile->name == _config.generateTTTGrid)
+            {
+                profile->load(query(), &_cache, _eventParameters.get(),
+                              _config.workingDirectory, !_config.keepWorkingFiles,
+                              false, false, false, false);
+                try {
+                    profile->generateTravelTimeGrid();
+                } catch ( exception &e ) {
+                    SEISCOMP_ERROR("Cannot generate travel time grid: %s", e.what());
+                }
+                profile->unload();
+                break;
+            }
+        }
+        return true;
+    }
+
     // load catalog waveforms and exit
     if ( !_config.loadProfile.empty() )
     {
@@ -1596,7 +1675,7 @@ void RTDD::convertOrigin(const HDD::CatalogCPtr& relocatedOrg,
             newArr = new Arrival();
             newArr->setCreationInfo(ci);
             newArr->setPickID(newPick->publicID());
-            newArr->setPhase(phase.type);
+            newArr->setPhase(phase.type.str());
 
             newOrg->add(newArr);
         }
@@ -1975,6 +2054,18 @@ void RTDD::Profile::evalXCorr()
     hypodd->evalXCorr();
 }
 
+
+void RTDD::Profile::generateTravelTimeGrid()
+{
+    if ( !loaded )
+    {
+        string msg = Core::stringify("Cannot generate travel time grid, profile %s not initialized", name.c_str());
+        throw runtime_error(msg.c_str());
+    }
+    lastUsage = Core::Time::GMT();
+    hypodd->generateTravelTimeGrid();
+}
+
 // End Profile class
 
 } // Seiscomp
@@ -121,6 +121,9 @@ class RTDD : public Application {
             bool        allowManualOrigin;
             int         profileTimeAlive; //seconds
             bool        cacheWaveforms;
+            int         threads;
+            int         neighboursCacheSize;
+            double      neighboursCacheTolerance; // km
             bool        cacheAllWaveforms;
             bool        debugWaveforms;
 
@@ -138,6 +141,7 @@ class RTDD : public Application {
             std::string dumpCatalogXML;
             std::string loadProfile;
             std::string evalXCorr;
+            std::string generateTTTGrid;
 
             // cron
             int         wakeupInterval;
@@ -164,6 +168,7 @@ class RTDD : public Application {
             HDD::CatalogPtr relocateSingleEvent(DataModel::Origin *org);
             HDD::CatalogPtr relocateCatalog();
             void evalXCorr();
+            void generateTravelTimeGrid();
 
             std::string name;
             std::string earthModelID;